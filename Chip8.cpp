@@ -1,22 +1,38 @@
 //
 // Created by Angel on 1/23/2023.
 //
-#include "chip8.h"
-
+#include "Chip8.h"
+#include "control_flow.h"
+#include "jit_compiler.h"
+#include "rewind_buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <vector>
+
+
+//times the rest of the enclosing scope into a pair of Profile counters, nothing unless CHIP8_PROFILE
+#if CHIP8_PROFILE
+struct ProfileTimer {
+    ProfileTimer(uint64_t & calls, uint64_t & nanoseconds)
+            : nanoseconds(nanoseconds), start(std::chrono::steady_clock::now()) { calls++; }
+    ~ProfileTimer() { nanoseconds += (std::chrono::steady_clock::now() - start).count(); }
+
+    uint64_t & nanoseconds;
+    std::chrono::steady_clock::time_point start;
+};
+#define CHIP8_PROFILE_SCOPE(calls, nanoseconds) ProfileTimer profileTimer(profileData.calls, profileData.nanoseconds)
+#else
+#define CHIP8_PROFILE_SCOPE(calls, nanoseconds)
+#endif
 
 
 /*
-    Chip8 - initializes the display buffer and load the font as well as the window
+    Chip8 - initializes the display buffer and load the font, and remembers the platform pieces
+    run() talks to
 */
-Chip8::Chip8(const char * filename, int scale, int cycleDelayMS) : consoleInterface("Chip-8", WIDTH, HEIGHT, scale) {
-    //set our clock speed from delay
-    this->delay = cycleDelayMS;
-
-
-    //Initialize the Display buffer
-    DisplayBuffer = new bool * [HEIGHT];
-    for(int i = 0; i < HEIGHT; i++)
-        DisplayBuffer[i] = new bool [WIDTH];
+Chip8::Chip8(Display * display, Input * input, Audio * audio, Timing * timing)
+        : display(display), input(input), audio(audio), timing(timing) {
 
     Op00E0(); //set to empty screen
 
@@ -28,14 +44,19 @@ Chip8::Chip8(const char * filename, int scale, int cycleDelayMS) : consoleInterf
 
 
     loadFont(MEMORY_BUFF, FONT_STARTING_ADDRESS, MEMORY_BUFF_SIZE);
+    seedRandom(DEFAULT_RANDOM_SEED);
+
+#if CHIP8_JIT
+    jit = new JitCompiler(*this);
+#endif
 }
 
 
+//out of line, where ControlFlowGraph and JitCompiler are complete
 Chip8::~Chip8(){
-    for(int i = 0; i < HEIGHT; i++)
-        delete [] DisplayBuffer[i];
-
-    delete [] DisplayBuffer;
+#if CHIP8_JIT
+    delete jit;
+#endif
 }
 
 
@@ -48,6 +69,8 @@ Chip8::~Chip8(){
         true - file is successfully loaded into memory
         false - file cannot be successfully loaded into memory - check is done in
                 function to see if ROM is larger than our memory buffer
+    Description:
+        Drops the previous ROM's control flow, controlFlow() recovers the new one on demand.
 */
 bool Chip8::loadROM(std::string filename) {
 
@@ -64,7 +87,7 @@ bool Chip8::loadROM(std::string filename) {
      auto ROMSize = end - begin;
 
      //compare with our buffer size, if we cannot fit, return false
-     if(ROMSize > MEMORY_BUFF_SIZE) {
+     if(ROMSize > MEMORY_BUFF_SIZE - STARTING_ADDR) {
          std::cout << "Error: ROM File Size is too large!!!\n\n";
          return false;
      }
@@ -75,12 +98,62 @@ bool Chip8::loadROM(std::string filename) {
 
      ROM.read((char*)MEMORY_BUFF+STARTING_ADDR, ROMSize);
      ROM.close();
+     invalidateAll();
+     loadedROMHash = hashBytes(MEMORY_BUFF+STARTING_ADDR, ROMSize);
+     loadedROMSize = (uint16_t)ROMSize;
+     controlFlowGraph.reset();
 
      ROM_loaded = true;
      return ROM_loaded;
 
 }
 
+/*
+    loadROM - loads a ROM image already in memory, used by ahead-of-time compiled binaries
+    which carry their ROM with them
+*/
+bool Chip8::loadROM(const uint8_t * data, size_t size) {
+    if(size > MEMORY_BUFF_SIZE - STARTING_ADDR) {
+        std::cout << "Error: ROM File Size is too large!!!\n\n";
+        return false;
+    }
+
+    for(size_t i = 0; i < size; i++)
+        MEMORY_BUFF[STARTING_ADDR + i] = data[i];
+
+    invalidateAll();
+    loadedROMHash = hashBytes(data, size);
+    loadedROMSize = (uint16_t)size;
+    controlFlowGraph.reset();
+
+    ROM_loaded = true;
+    return ROM_loaded;
+}
+
+
+const ControlFlowGraph & Chip8::controlFlow() const {
+    if(controlFlowGraph == nullptr) {
+        controlFlowGraph.reset(new ControlFlowGraph());
+        controlFlowGraph->analyze(MEMORY_BUFF, STARTING_ADDR, STARTING_ADDR + loadedROMSize);
+    }
+    return *controlFlowGraph;
+}
+
+
+
+
+/*
+    hashBytes - FNV-1a, identifies a ROM image
+*/
+uint64_t Chip8::hashBytes(const uint8_t * data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
 
 
 
@@ -105,130 +178,908 @@ void Chip8::loadFont(uint8_t * MEMORY_BUFFER, int start_address, int size){
 
 
 
+/*
+    run - main loop: poll input, run a frame, update the tone, present the display and wait for
+    the next frame on the Timing. Returns once the Input asks to quit, so without one it runs
+    forever - headless callers drive frame() themselves instead.
+    In turbo mode frames run back to back as fast as the host allows, input and the display are
+    only serviced at the present rate and a status line reports the throughput every second.
+    With a RewindBuffer set every pass through the loop is recorded, and while the Input says it
+    is rewinding the loop steps back through them at the speed they were recorded.
+    With run-ahead on, the display is shown from a few frames in the future, see presentAhead.
+*/
 void Chip8::run(){
-    auto time_point =  std::chrono::steady_clock::now();
+    const auto statsPeriod = std::chrono::seconds(1);
+    auto now = std::chrono::steady_clock::now();
+    auto nextPresent = now;
+    auto statsStart = now;
+
+    uint64_t lastInstructions = instructionCount, lastFrames = frameCount, lastPresents = presentCount;
+
     PC = STARTING_ADDR;
+    recordRewind();
+    bool rewinding = false;
+    if(display != nullptr) display->start();
     while(true) {
-        if(consoleInterface.recordInput(keypad)) break;
+        bool present = !turbo || now >= nextPresent;
+        if(present && input != nullptr) {
+            if(input->recordInput(keypad)) break;
+            rewinding = rewindBuffer != nullptr && input->rewinding();
+        }
 
-        if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_point).count() > delay){
-            cycle();
-            consoleInterface.renderDisplay(DisplayBuffer);
-            time_point = std::chrono::steady_clock::now();
+        if(rewinding)
+            stepBack();
+        else {
+            if(turbo)
+                for(int i = 0; i < TURBO_FRAMES_PER_CHECK; i++) frame();
+            else
+                frame();
+            recordRewind();
         }
+
+        if(audio != nullptr) audio->setTone(sound_timer > 0);
+
+        if(present) {
+            if(runAheadFrames > 0 && !rewinding) presentAhead();
+            else {
+                if(display != nullptr) {
+                    CHIP8_PROFILE_SCOPE(presents, presentNanoseconds);
+                    display->renderDisplay(DisplayBuffer, presentedAhead ? Display::ALL_ROWS : dirtyRows);
+                }
+                presentedAhead = false;
+            }
+            dirtyRows = 0;
+            presentCount++;
+            nextPresent = now + std::chrono::nanoseconds(1000000000 / presentRate);
+        }
+
+        now = std::chrono::steady_clock::now();
+        if(now - statsStart >= statsPeriod) {
+            std::chrono::duration<double> elapsed = now - statsStart;
+            updateStats(elapsed.count(), instructionCount - lastInstructions, frameCount - lastFrames, presentCount - lastPresents);
+            lastInstructions = instructionCount, lastFrames = frameCount, lastPresents = presentCount;
+            statsStart = now;
+
+            if(turbo || runAheadFrames > 0) {
+                std::cout << (turbo ? "\rturbo: " : "\r") << std::fixed << std::setprecision(2) << lastStats.instructionsPerSecond / 1e6
+                          << " MIPS, " << (uint64_t)(lastStats.framesPerSecond + 0.5) << " FPS, "
+                          << (uint64_t)(lastStats.presentsPerSecond + 0.5) << " presents/s";
+                if(runAheadFrames > 0)
+                    std::cout << ", run-ahead " << runAheadFrames << ": " << lastStats.runAheadMicroseconds << " us/present";
+                std::cout << "   " << std::flush;
+            }
+        }
+
+        if(turbo || timing == nullptr) continue;
+
+        timing->waitForFrame();
+        now = std::chrono::steady_clock::now();
     }
+    if(audio != nullptr) audio->setTone(false);
+    if(display != nullptr) display->stop();
 }
 
 
+/*
+    frame - runs one frame worth of instructions then ticks the 60 Hz timers once. A breakpoint
+    or watchpoint ends it early, without the tick, and the next call finishes the frame
+*/
+void Chip8::frame() {
+    stop = STOP_NONE;
+    unsigned long budget = frameProgress < (unsigned long)instructionsPerFrame ? instructionsPerFrame - frameProgress : 0;
+    unsigned long executed = execute(budget);
+    instructionCount += executed;
+    frameProgress += executed;
+
+    if(stop != STOP_NONE && frameProgress < (unsigned long)instructionsPerFrame) return;
+    frameProgress = 0;
+    frameCount++;
+    tickTimers();
+}
 
 
+/*
+    setInstructionsPerFrame - sets the clock speed, at least one instruction per frame
+*/
+void Chip8::setInstructionsPerFrame(int instructionsPerFrame) {
+    this->instructionsPerFrame = instructionsPerFrame > 0 ? instructionsPerFrame : 1;
+}
 
 
+/*
+    setTurbo - turns the frame throttle off or back on. presentRate is how many times a second
+    turbo mode polls input and draws the display
+*/
+void Chip8::setTurbo(bool turbo, int presentRate) {
+    this->turbo = turbo;
+    this->presentRate = presentRate > 0 ? presentRate : 1;
+}
 
 
+/*
+    setRunAhead - how many frames into the future every present shows, 0 turns run-ahead off
+*/
+void Chip8::setRunAhead(int frames) {
+    runAheadFrames = frames > 0 ? frames : 0;
+}
 
 
+/*
+    seedRandom - restarts Cxkk's generator, seeded the way PCG32 is seeded
+*/
+void Chip8::seedRandom(uint64_t seed) {
+    randomState = 0;
+    nextRandom();
+    randomState += seed;
+    nextRandom();
+}
 
 
+/*
+    saveState - copies the machine into state, a few kilobytes with no allocation
+*/
+void Chip8::saveState(SaveState & state) const {
+    static_assert(sizeof(SaveState) == 96 + 8 * HEIGHT + MEMORY_BUFF_SIZE, "SaveState must have no padding");
+
+    state.magic = SAVE_STATE_MAGIC;
+    state.version = SAVE_STATE_VERSION;
+    state.PC = PC;
+    state.I = I;
+    state.keys = 0;
+    for(int key = 0; key < 16; key++)
+        state.keys |= keypad[key] << key;
+    std::memcpy(state.stack, RA_Stack, sizeof(state.stack));
+    std::memcpy(state.registers, registers, sizeof(state.registers));
+    state.SP = SP;
+    state.delayTimer = delay_timer;
+    state.soundTimer = sound_timer;
+    state.reserved = 0;
+    state.randomState = randomState;
+    state.instructions = instructionCount;
+    state.frames = frameCount;
+    state.frameProgress = (uint32_t)frameProgress;
+    state.padding = 0;
+    std::memcpy(state.display, DisplayBuffer, sizeof(state.display));
+    std::memcpy(state.memory, MEMORY_BUFF, sizeof(state.memory));
+}
 
 
+/*
+    loadState - puts the machine back to a saved state
+    Return Value : false, with the machine untouched, if the state is from another version or
+                   its SP or PC point outside the stack or memory. A running machine keeps SP
+                   below STACK_SIZE, see Op2nnn
+    Description:
+        Only the memory bytes that differ are written, through invalidate(), so the pre-decode
+        cache and translated blocks survive a restore unless the state changed their code.
+*/
+bool Chip8::loadState(const SaveState & state) {
+    if(state.magic != SAVE_STATE_MAGIC || state.version != SAVE_STATE_VERSION) {
+        std::cout << "Error: save state is not a version " << SAVE_STATE_VERSION << " Chip8 state\n";
+        return false;
+    }
+    if(state.SP >= STACK_SIZE || state.PC >= MEMORY_BUFF_SIZE) {
+        std::cout << "Error: save state has SP " << (int)state.SP << " and PC " << state.PC << ", out of range\n";
+        return false;
+    }
 
-void Chip8::cycle() {
-    //fetch
-    opcode = (MEMORY_BUFF[PC] << 8) | MEMORY_BUFF[PC+1];
-    PC+=2;
+    const unsigned int CHUNK = 64;                      //compared whole, most of them match
+    for(unsigned int chunk = 0; chunk < MEMORY_BUFF_SIZE; chunk += CHUNK) {
+        if(std::memcmp(MEMORY_BUFF + chunk, state.memory + chunk, CHUNK) == 0) continue;
+
+        for(unsigned int address = chunk; address < chunk + CHUNK; address++) {
+            if(MEMORY_BUFF[address] != state.memory[address]) {
+                MEMORY_BUFF[address] = state.memory[address];
+                invalidate(address);
+            }
+        }
+    }
+
+    PC = state.PC;
+    I = state.I;
+    for(int key = 0; key < 16; key++)
+        keypad[key] = (state.keys >> key) & 1;
+    std::memcpy(RA_Stack, state.stack, sizeof(RA_Stack));
+    std::memcpy(registers, state.registers, sizeof(registers));
+    SP = state.SP;
+    delay_timer = state.delayTimer;
+    sound_timer = state.soundTimer;
+    randomState = state.randomState;
+    instructionCount = state.instructions;
+    frameCount = state.frames;
+    frameProgress = state.frameProgress;
+    std::memcpy(DisplayBuffer, state.display, sizeof(DisplayBuffer));
+    dirtyRows = ~0u;                                    //the whole screen may have changed
+
+    ROM_loaded = true;
+    return true;
+}
+
+bool Chip8::loadState(const void * data, size_t size) {
+    if(size != sizeof(SaveState)) {
+        std::cout << "Error: save state is " << size << " bytes, expected " << sizeof(SaveState) << "\n";
+        return false;
+    }
+
+    SaveState state;
+    std::memcpy(&state, data, sizeof(state));
+    return loadState(state);
+}
+
+
+/*
+    recordRewind - adds the machine as it is now to the rewind history, if there is one
+*/
+void Chip8::recordRewind() {
+    if(rewindBuffer == nullptr) return;
+
+    SaveState state;
+    saveState(state);
+    rewindBuffer->record(state);
+}
+
+/*
+    stepBack - goes back to the previously recorded state. The keypad stays what the player is
+    holding now and the counters behind stats() keep counting
+*/
+void Chip8::stepBack() {
+    SaveState state;
+    if(!rewindBuffer->rewind(state)) return;
+
+    bool held[16];
+    std::memcpy(held, keypad, sizeof(held));
+    uint64_t instructions = instructionCount, frames = frameCount;
+
+    loadState(state);
+
+    std::memcpy(keypad, held, sizeof(keypad));
+    instructionCount = instructions;
+    frameCount = frames;
+}
+
+
+/*
+    presentAhead - run-ahead present: saves the machine, runs runAheadFrames more frames with the
+    keys held now, presents that display and restores the save. A game that answers a key a
+    frame or two late then shows the answer on the present the key arrived for.
+    Description:
+        The rows sent as changed are the ones differing from the last run-ahead present, the
+        machine's own dirtyRows describe the real timeline, not what is on screen.
+        The look-ahead frames are thrown away, so they are kept out of the trace and the profile,
+        which only ever hold instructions of the real timeline.
+*/
+void Chip8::presentAhead() {
+    auto start = std::chrono::steady_clock::now();
+
+    SaveState now;
+    saveState(now);
+
+    TraceBuffer * tracing = trace;
+    trace = nullptr;
+#if CHIP8_PROFILE
+    Profile profiled = profileData;
+#endif
+    for(int i = 0; i < runAheadFrames; i++) frame();
+#if CHIP8_PROFILE
+    profileData = profiled;
+#endif
+    trace = tracing;
+
+    uint32_t changed = presentedAhead ? 0 : Display::ALL_ROWS;
+    for(int y = 0; y < HEIGHT; y++) {
+        if(DisplayBuffer[y] != runAheadShown[y]) changed |= 1u << y;
+        runAheadShown[y] = DisplayBuffer[y];
+    }
+    if(display != nullptr) {
+        CHIP8_PROFILE_SCOPE(presents, presentNanoseconds);
+        display->renderDisplay(DisplayBuffer, changed);
+    }
+    presentedAhead = true;
+
+    loadState(now);
+
+    runAheadTime += std::chrono::steady_clock::now() - start;
+    runAheadCount++;
+}
+
+
+/*
+    updateStats - turns the counts from the last measuring window into rates for stats()
+*/
+void Chip8::updateStats(double seconds, uint64_t instructions, uint64_t frames, uint64_t presents) {
+    lastStats.instructionsPerSecond = instructions / seconds;
+    lastStats.framesPerSecond = frames / seconds;
+    lastStats.presentsPerSecond = presents / seconds;
+
+    lastStats.runAheadMicroseconds = runAheadCount > 0 ? runAheadTime.count() / 1e3 / runAheadCount : 0;
+    runAheadTime = std::chrono::nanoseconds(0);
+    runAheadCount = 0;
+}
 
-    //decode
-    void(Chip8::*opFunctionPtr)() = nullptr;
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*
+    decode - maps a single opcode to its handler index. Only used to fill the dispatch tables
+    at startup, the fetch/execute cycle never walks this switch.
+    Return Value : OpIndex for the opcode, OP_Trap if the opcode is not a valid instruction
+*/
+Chip8::OpIndex Chip8::decode(uint16_t opcode) {
+    OpIndex opIndex = OP_Trap;      //bad opcodes all share the one trap handler
     switch(opcode >> 12){
         case 0:
             switch(opcode & 0x00FF){
-                case 0xE0: opFunctionPtr =  &Chip8::Op00E0; break;
-                case 0xEE: opFunctionPtr =  &Chip8::Op00EE; break;
-                default: opFunctionPtr = &Chip8::Op0nnn; break;
+                case 0xE0: opIndex =  OP_00E0; break;
+                case 0xEE: opIndex =  OP_00EE; break;
+                default: opIndex = OP_0nnn; break;
             }
             break;
 
-        case 1: opFunctionPtr = &Chip8::Op1nnn; break;
-        case 2: opFunctionPtr = &Chip8::Op2nnn; break;
-        case 3: opFunctionPtr = &Chip8::Op3xkk; break;
-        case 4: opFunctionPtr = &Chip8::Op4xkk; break;
-        case 5: if(opcode % 16 == 0) opFunctionPtr = &Chip8::Op5xy0; break;
-        case 6: opFunctionPtr = &Chip8::Op6xkk; break;
-        case 7: opFunctionPtr = &Chip8::Op7xkk; break;
+        case 1: opIndex = OP_1nnn; break;
+        case 2: opIndex = OP_2nnn; break;
+        case 3: opIndex = OP_3xkk; break;
+        case 4: opIndex = OP_4xkk; break;
+        case 5: if(opcode % 16 == 0) opIndex = OP_5xy0; break;
+        case 6: opIndex = OP_6xkk; break;
+        case 7: opIndex = OP_7xkk; break;
 
         case 8:
             switch(opcode & 0x000F) {
-                case 1: opFunctionPtr   =   &Chip8::Op8xy1; break;
-                case 0: opFunctionPtr   =   &Chip8::Op8xy0; break;
-                case 2: opFunctionPtr   =   &Chip8::Op8xy2; break;
-                case 3: opFunctionPtr   =   &Chip8::Op8xy3; break;
-                case 4: opFunctionPtr   =   &Chip8::Op8xy4; break;
-                case 5: opFunctionPtr   =   &Chip8::Op8xy5; break;
-                case 6: opFunctionPtr   =   &Chip8::Op8xy6; break;
-                case 7: opFunctionPtr   =   &Chip8::Op8xy7; break;
-                case 0xE: opFunctionPtr =   &Chip8::Op8xyE; break;
+                case 1: opIndex   =   OP_8xy1; break;
+                case 0: opIndex   =   OP_8xy0; break;
+                case 2: opIndex   =   OP_8xy2; break;
+                case 3: opIndex   =   OP_8xy3; break;
+                case 4: opIndex   =   OP_8xy4; break;
+                case 5: opIndex   =   OP_8xy5; break;
+                case 6: opIndex   =   OP_8xy6; break;
+                case 7: opIndex   =   OP_8xy7; break;
+                case 0xE: opIndex =   OP_8xyE; break;
             }
             break;
 
-        case 9: if(opcode % 16 == 0) opFunctionPtr = &Chip8::Op9xy0; break;
-        case 0xA: opFunctionPtr = &Chip8::OpAnnn; break;
-        case 0xB: opFunctionPtr = &Chip8::OpBnnn; break;
-        case 0xC: opFunctionPtr = &Chip8::OpCxkk; break;
-        case 0xD: opFunctionPtr = &Chip8::OpDxyn; break;
+        case 9: if(opcode % 16 == 0) opIndex = OP_9xy0; break;
+        case 0xA: opIndex = OP_Annn; break;
+        case 0xB: opIndex = OP_Bnnn; break;
+        case 0xC: opIndex = OP_Cxkk; break;
+        case 0xD: opIndex = OP_Dxyn; break;
 
         case 0xE:
             switch(opcode & 0x00FF){
-                case 0x9E: opFunctionPtr = &Chip8::OpEx9E; break;
-                case 0xA1: opFunctionPtr = &Chip8::OpExA1; break;
+                case 0x9E: opIndex = OP_Ex9E; break;
+                case 0xA1: opIndex = OP_ExA1; break;
             }
             break;
 
         case 0xF:
             switch(opcode & 0x00FF) {
-                case 0x07: opFunctionPtr = &Chip8::OpFx07; break;
-                case 0x0A: opFunctionPtr = &Chip8::OpFx0A; break;
-                case 0x15: opFunctionPtr = &Chip8::OpFx15; break;
-                case 0x18: opFunctionPtr = &Chip8::OpFx18; break;
-                case 0x1E: opFunctionPtr = &Chip8::OpFx1E; break;
-                case 0x29: opFunctionPtr = &Chip8::OpFx29; break;
-                case 0x33: opFunctionPtr = &Chip8::OpFx33; break;
-                case 0x55: opFunctionPtr = &Chip8::OpFx55; break;
-                case 0x65: opFunctionPtr = &Chip8::OpFx65; break;
+                case 0x07: opIndex = OP_Fx07; break;
+                case 0x0A: opIndex = OP_Fx0A; break;
+                case 0x15: opIndex = OP_Fx15; break;
+                case 0x18: opIndex = OP_Fx18; break;
+                case 0x1E: opIndex = OP_Fx1E; break;
+                case 0x29: opIndex = OP_Fx29; break;
+                case 0x33: opIndex = OP_Fx33; break;
+                case 0x55: opIndex = OP_Fx55; break;
+                case 0x65: opIndex = OP_Fx65; break;
             }
             break;
 
     }
 
-    //execute
+    return opIndex;
+}
+
+
+/*
+    buildOpTable - decodes all 64K opcodes once so a decode is a single table load
+*/
+#define CHIP8_OP_HANDLER(name) &invoke<&Chip8::Op##name>,
+const Chip8::OpFunction Chip8::opHandlers[Chip8::OP_COUNT] = { CHIP8_OP_LIST(CHIP8_OP_HANDLER) };
+#undef CHIP8_OP_HANDLER
+
+const char * Chip8::opName(uint8_t index) {
+    #define CHIP8_OP_NAME(name) #name,
+    static const char * const names[OP_COUNT] = { CHIP8_OP_LIST(CHIP8_OP_NAME) };
+    #undef CHIP8_OP_NAME
+    return index < OP_COUNT ? names[index] : "Trap";
+}
+
+uint8_t Chip8::opTable[Chip8::OPCODE_COUNT];
+const bool Chip8::opTableBuilt = Chip8::buildOpTable();
+
+bool Chip8::buildOpTable() {
+    for(unsigned int i = 0; i < OPCODE_COUNT; i++)
+        opTable[i] = decode(i);
+
+    return true;
+}
+
+
+/*
+    decodeInstruction - fills an instruction slot with the handler and every operand field
+    so the Op functions never have to mask the opcode themselves
+*/
+void Chip8::decodeInstruction(uint16_t opcode, Instruction & instruction) {
+    instruction.opcode  = opcode;
+    instruction.nnn     = opcode & 0x0FFF;
+    instruction.x       = (opcode & 0x0F00) >> 8;
+    instruction.y       = (opcode & 0x00F0) >> 4;
+    instruction.n       = opcode & 0x000F;
+    instruction.kk      = opcode & 0x00FF;
+    instruction.index   = opTable[opcode];
+    instruction.handler = opHandlers[instruction.index];
+}
+
+
+/*
+    invalidate - drops the pre-decoded slot holding the byte at address, must be called
+    by anything that writes to MEMORY_BUFF after a ROM starts running
+*/
+void Chip8::invalidate(uint16_t address) {
+    decodeCache[(address >> 1) & (DECODE_CACHE_SIZE - 1)].handler = nullptr;
+
+    //writing into translated code drops every block, self modifying code is rare enough
+    //that tracking which blocks overlap the address isn't worth it
+    if(codeMap[address & (MEMORY_BUFF_SIZE - 1)]) flushBlocks();
+
+    //ahead-of-time blocks can't be retranslated, the interpreter takes over the bytes instead.
+    //Only a write into one of them walks the table
+    address &= MEMORY_BUFF_SIZE - 1;
+    if(!nativeMap[address]) return;
+
+    for(size_t i = 0; i < nativeCount; i++) {
+        const NativeBlockEntry & entry = nativeEntries[i];
+        if(address >= entry.address && address < entry.address + 2 * entry.length)
+            nativeBlocks[entry.address >> 1] = nullptr;
+    }
+    mapNativeBlocks();
+}
+
+void Chip8::invalidateAll() {
+    for(unsigned int i = 0; i < DECODE_CACHE_SIZE; i++)
+        decodeCache[i].handler = nullptr;
+
+    flushBlocks();
+}
+
+
+/*
+    endsBlock - true for instructions that read or change PC, and for the ones that write to
+    memory so a block can never run past code it has just overwritten
+*/
+bool Chip8::endsBlock(uint8_t index) {
+    switch(index) {
+        case OP_Trap: case OP_0nnn: case OP_00EE: case OP_1nnn: case OP_2nnn:
+        case OP_3xkk: case OP_4xkk: case OP_5xy0: case OP_9xy0: case OP_Bnnn:
+        case OP_Ex9E: case OP_ExA1: case OP_Fx0A: case OP_Fx33: case OP_Fx55:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+/*
+    translateBlock - decodes the block starting at an even address into the pre-decode cache
+    and marks the bytes it covers so writes to them flush every translated block
+    Return Value : number of instructions in the block, the last one may end it
+*/
+uint16_t Chip8::translateBlock(uint16_t address) {
+    uint16_t length = 0;
+    uint16_t pc = address;
+
+    do {
+        Instruction & slot = decodeCache[pc >> 1];
+        if(slot.handler == nullptr)
+            decodeInstruction((MEMORY_BUFF[pc] << 8) | MEMORY_BUFF[pc+1], slot);
+
+        codeMap[pc] = true;
+        codeMap[pc+1] = true;
+        length++;
+        pc += 2;
+
+        if(endsBlock(slot.index)) break;
+    } while(pc < MEMORY_BUFF_SIZE && length < MAX_BLOCK_LENGTH);
+
+    return length;
+}
+
+void Chip8::flushBlocks() {
+    codeMap.reset();
+
+#if CHIP8_JIT
+    if(jit != nullptr) jit->flush();
+#endif
+}
+
+
+/*
+    idleLoopAt - recognises the idle loop starting at address, straight from memory so it is
+    never out of date with self modifying code
+*/
+Chip8::IdleLoop Chip8::idleLoopAt(uint16_t address) const {
+    if((address & ~(MEMORY_BUFF_SIZE - 2)) != 0) return IDLE_NONE;
+
+    uint16_t opcode = (MEMORY_BUFF[address] << 8) | MEMORY_BUFF[address+1];
+    switch(opTable[opcode]) {
+        case OP_1nnn:
+            return (opcode & 0x0FFF) == address ? IDLE_JUMP_SELF : IDLE_NONE;
+
+        case OP_Fx0A:
+            return IDLE_KEY_WAIT;
+
+        case OP_Fx07: {
+            if(address + 6u > MEMORY_BUFF_SIZE) return IDLE_NONE;
+
+            uint16_t skip = (MEMORY_BUFF[address+2] << 8) | MEMORY_BUFF[address+3];
+            uint16_t jump = (MEMORY_BUFF[address+4] << 8) | MEMORY_BUFF[address+5];
+            bool waits = skip == (0x3000 | (opcode & 0x0F00)) && jump == (0x1000 | address);
+            return waits ? IDLE_TIMER_WAIT : IDLE_NONE;
+        }
+
+        default:
+            return IDLE_NONE;
+    }
+}
 
-    //if nullptr, then throw an error for bad opcode
-    if(opFunctionPtr != nullptr) ((*this).*opFunctionPtr)();
+
+/*
+    skipIdle - when PC sits at the top of an idle loop, does up to budget instructions worth of
+    it in one go, leaving the machine exactly where running them one by one would
+    Return Value : number of instructions skipped, 0 when PC is not in an idle loop
+*/
+unsigned long Chip8::skipIdle(unsigned long budget) {
+    unsigned long skipped = budget;                     //stalled until the end of the budget
+    if(debugging) return 0;                             //a breakpoint in the loop has to be hit
+    if(trace != nullptr) return 0;                      //and a trace has to see every pass
+
+    switch(idleLoopAt(PC)) {
+        case IDLE_JUMP_SELF:
+            break;
+
+        case IDLE_KEY_WAIT:
+            for(uint8_t i = 0; i < 16; i++)
+                if(keypad[i]) return 0;
+            break;
+
+        case IDLE_TIMER_WAIT:
+            //the delay timer only moves between frames, so once it reads non zero the loop
+            //spins for the rest of the budget. Whole passes only, the interpreter finishes
+            //the last one or two instructions
+            if(delay_timer == 0 || budget < 3) return 0;
+
+            registers[MEMORY_BUFF[PC] & 0x0F] = delay_timer;
+            skipped = budget - budget % 3;
+            break;
+
+        default:
+            return 0;
+    }
+
+#if CHIP8_PROFILE
+    profileData.idleInstructions += skipped;
+#endif
+    return skipped;
+}
+
+
+/*
+    fetch - points inst at the pre-decoded instruction for PC. Even addresses are served from
+    the pre-decode cache, an odd PC is rare enough to be decoded every time into the scratch slot
+*/
+inline void Chip8::fetch() {
+    if((PC & ~(MEMORY_BUFF_SIZE - 2)) == 0) {          //PC is even and inside MEMORY_BUFF
+        Instruction & slot = decodeCache[PC >> 1];
+        if(slot.handler == nullptr)
+            decodeAt(PC, slot);
+        inst = &slot;
+    }
     else {
-        std::stringstream ss;
-        ss << std::hex << opcode;
-        std::string errorMsg(ss.str());
-        errorMsg = "FATAL ERROR : BAD OPCODE 0x"+errorMsg;
-        std::cout << errorMsg << std::endl;
+        decodeAt(PC & (MEMORY_BUFF_SIZE-1), scratch);
+        inst = &scratch;
+    }
+}
+
+/*
+    decodeAt - decodes the instruction at address into slot, or OpBreak over it if a breakpoint
+    is set there. Kept out of fetch() so the hit path stays small enough to inline everywhere
+*/
+void Chip8::decodeAt(uint16_t address, Instruction & slot) {
+    decodeInstruction((MEMORY_BUFF[address] << 8) | MEMORY_BUFF[(address+1) & (MEMORY_BUFF_SIZE-1)], slot);
+    if(breakpoints[address]) {
+        slot.index = OP_Break;
+        slot.handler = opHandlers[OP_Break];
+    }
+}
+
+/*
+    cycle - reference fetch/decode/execute of a single instruction through the handler table
+*/
+void Chip8::cycle() {
+    //fetch + decode
+    fetch();
+    traceInstruction();
+    profileInstruction();
+    PC+=2;
+
+    //execute
+    inst->handler(*this);
+}
+
+
+/*
+    execute - runs up to budget instructions and returns how many were run.
+        CHIP8_JIT_DISPATCH      - basic blocks are compiled to x86-64 and chained, on other hosts
+                                  this falls back to the threaded backend
+        CHIP8_THREADED_DISPATCH - every handler jumps straight to the next one through computed
+                                  goto labels (GCC/Clang only)
+        neither                 - loops over cycle()
+    CHIP8_PROFILE builds, a set trace and breakpoints or watchpoints skip the JIT and
+    ahead-of-time blocks, which run code none of them can see
+*/
+unsigned long Chip8::execute(unsigned long budget) {
+#if !CHIP8_PROFILE
+    bool interpretOnly = trace != nullptr || debugging;
+    if(nativeCount != 0 && !interpretOnly) return executeNative(budget);
+#if CHIP8_JIT
+    if(!interpretOnly) return jit->run(budget);
+#endif
+#endif
+    unsigned long executed = 0;
+    traceCycle = instructionCount;                      //frame() adds executed once this returns
+
+#if defined(CHIP8_THREADED_DISPATCH) && defined(__GNUC__)
+    #define CHIP8_OP_LABEL_ADDRESS(name) &&op_##name,
+    static const void * const labels[OP_COUNT] = { CHIP8_OP_LIST(CHIP8_OP_LABEL_ADDRESS) };
+    #undef CHIP8_OP_LABEL_ADDRESS
+
+    //dispatch the next instruction, or leave once the budget is spent
+    #define CHIP8_DISPATCH()                    \
+        if(executed == budget) goto done;       \
+        executed++;                             \
+        fetch();                                \
+        traceInstruction();                     \
+        profileInstruction();                   \
+        PC+=2;                                  \
+        goto *labels[inst->index];
+
+    CHIP8_DISPATCH();
+
+    //the jump and key wait labels also check whether they are spinning in an idle loop, the
+    //breakpoint and memory write labels whether the debugger stopped the machine
+    #define CHIP8_OP_LABEL(name)                \
+        op_##name:                              \
+            Op##name();                         \
+            if(OP_##name == OP_1nnn || OP_##name == OP_Fx0A) \
+                executed += skipIdle(budget - executed);     \
+            if((OP_##name == OP_Break || OP_##name == OP_Fx33 || OP_##name == OP_Fx55) && stop != STOP_NONE) { \
+                if(OP_##name == OP_Break) executed--;        \
+                goto done;                                   \
+            }                                   \
+            CHIP8_DISPATCH();
+    CHIP8_OP_LIST(CHIP8_OP_LABEL)
+    #undef CHIP8_OP_LABEL
+    #undef CHIP8_DISPATCH
+
+done:
+#else
+    while(executed < budget) {
+        cycle();
+        executed++;
+
+        if(inst->index == OP_1nnn || inst->index == OP_Fx0A)
+            executed += skipIdle(budget - executed);
+        else if(inst->index >= OP_Fx33 && stop != STOP_NONE) {      //Fx33, Fx55, Fx65 or Break
+            if(inst->index == OP_Break) executed--;
+            break;
+        }
+    }
+#endif
+
+    return executed;
+}
+
+
+/*
+    setNativeBlocks - installs ahead-of-time compiled blocks for the loaded ROM, from then on
+    execute() runs them whenever PC lands on one
+*/
+void Chip8::setNativeBlocks(const NativeBlockEntry * entries, size_t count) {
+    for(unsigned int i = 0; i < DECODE_CACHE_SIZE; i++)
+        nativeBlocks[i] = nullptr;
+
+    for(size_t i = 0; i < count; i++)
+        nativeBlocks[entries[i].address >> 1] = &entries[i];
+
+    nativeEntries = entries;
+    nativeCount = count;
+    mapNativeBlocks();
+}
+
+/*
+    mapNativeBlocks - marks the bytes of the blocks still in nativeBlocks in nativeMap
+*/
+void Chip8::mapNativeBlocks() {
+    nativeMap.reset();
+    for(size_t i = 0; i < nativeCount; i++) {
+        const NativeBlockEntry & entry = nativeEntries[i];
+        if(nativeBlocks[entry.address >> 1] != &entry) continue;
+
+        for(unsigned int at = entry.address; at < entry.address + 2u * entry.length && at < MEMORY_BUFF_SIZE; at++)
+            nativeMap[at] = true;
     }
+}
+
+
+/*
+    executeNative - runs ahead-of-time blocks where there is one for PC and the budget allows,
+    single steps the reference interpreter everywhere else
+*/
+unsigned long Chip8::executeNative(unsigned long budget) {
+    unsigned long executed = 0;
 
+    while(executed < budget) {
+        const NativeBlockEntry * block = (PC & ~(MEMORY_BUFF_SIZE - 2)) == 0 ? nativeBlocks[PC >> 1] : nullptr;
+
+        if(block != nullptr && block->length <= budget - executed) {
+            block->block(*this);
+            executed += block->length;
+        }
+        else {
+            cycle();
+            executed++;
+        }
 
-    if(delay_timer > 0) {
-        delay_timer--;
+        executed += skipIdle(budget - executed);
     }
 
-    if(sound_timer > 0) {
-        sound_timer--;
+    return executed;
+}
+
+
+/*
+    dumpTrace - writes the trace, the instruction that ran last included
+    Return Value : false without a trace or if the file can't be written
+*/
+bool Chip8::dumpTrace(const std::string & filename) {
+    if(trace == nullptr) {
+        std::cout << "Error: no trace to write to " << filename << "\n";
+        return false;
     }
 
+    trace->finish(registers);
+    return trace->dump(filename);
 }
 
 
+/*
+    setBreakpoint - sets or clears the breakpoint at address. The slot holding it is decoded
+    again, fetch() patches OpBreak over the instruction while the bit is set
+*/
+void Chip8::setBreakpoint(uint16_t address, bool enabled) {
+    address &= MEMORY_BUFF_SIZE - 1;
+    breakpoints[address] = enabled;
+    debugging = breakpoints.any() || watchpoints.any();
+
+    decodeCache[address >> 1].handler = nullptr;
+}
+
+void Chip8::setWatchpoint(uint16_t address, bool enabled) {
+    watchpoints[address & (MEMORY_BUFF_SIZE - 1)] = enabled;
+    debugging = breakpoints.any() || watchpoints.any();
+}
+
+
+/*
+    step - runs exactly the instruction at PC, even with a breakpoint on it, and ticks the timers
+    if that finished the frame. A watchpoint it writes to shows in stopReason()
+*/
+void Chip8::step() {
+    stop = STOP_NONE;
+
+    decodeInstruction((MEMORY_BUFF[PC & (MEMORY_BUFF_SIZE-1)] << 8) | MEMORY_BUFF[(PC+1) & (MEMORY_BUFF_SIZE-1)], scratch);
+    inst = &scratch;
+    traceCycle = instructionCount;
+    traceInstruction();
+    profileInstruction();
+    PC += 2;
+    inst->handler(*this);
+    instructionCount++;
+
+    if(++frameProgress >= (unsigned long)instructionsPerFrame) {
+        frameProgress = 0;
+        frameCount++;
+        tickTimers();
+    }
+}
+
+
+/*
+    writeProfile - dumps the profile as JSON: executions per opcode class and per address, both
+    busiest first, and the time spent drawing and presenting
+    Return Value : false if the file can't be written or this build doesn't profile
+*/
+bool Chip8::writeProfile(const std::string & filename) const {
+#if CHIP8_PROFILE
+    std::ofstream out(filename);
+    if(!out.is_open()) {
+        std::cout << "Error: cannot write " << filename << "\n";
+        return false;
+    }
+
+    //busiest first, never executed left out
+    auto busiest = [](const uint64_t * counts, size_t size) {
+        std::vector<size_t> order;
+        for(size_t i = 0; i < size; i++)
+            if(counts[i] != 0) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [counts](size_t a, size_t b) { return counts[a] > counts[b]; });
+        return order;
+    };
+    auto timing = [&out](const char * name, uint64_t calls, uint64_t nanoseconds) {
+        out << "  \"" << name << "\": {\"calls\": " << calls << ", \"total_us\": " << nanoseconds / 1e3
+            << ", \"average_ns\": " << (calls > 0 ? (double)nanoseconds / calls : 0) << "}";
+    };
+
+    uint64_t counted = 0;
+    for(uint64_t count : profileData.opcodes) counted += count;
+
+    out << "{\n  \"instructions\": " << counted << ",\n  \"idle_instructions\": " << profileData.idleInstructions << ",\n";
+
+    out << "  \"opcodes\": [";
+    std::vector<size_t> opcodes = busiest(profileData.opcodes, 256);
+    for(size_t i = 0; i < opcodes.size(); i++)
+        out << (i ? ",\n" : "\n") << "    {\"op\": \"" << opName((uint8_t)opcodes[i]) << "\", \"count\": " << profileData.opcodes[opcodes[i]] << "}";
+    out << "\n  ],\n";
+
+    out << "  \"hot_pcs\": [";
+    std::vector<size_t> addresses = busiest(profileData.addresses, MEMORY_BUFF_SIZE);
+    for(size_t i = 0; i < addresses.size(); i++) {
+        size_t pc = addresses[i];
+        uint16_t opcode = (MEMORY_BUFF[pc] << 8) | MEMORY_BUFF[(pc + 1) & (MEMORY_BUFF_SIZE - 1)];
+        out << (i ? ",\n" : "\n") << "    {\"pc\": \"0x" << std::hex << std::setw(3) << std::setfill('0') << pc
+            << "\", \"opcode\": \"" << std::setw(4) << opcode << std::dec << std::setfill(' ')
+            << "\", \"op\": \"" << opName(opTable[opcode]) << "\", \"count\": " << profileData.addresses[pc] << "}";
+    }
+    out << "\n  ],\n";
+
+    timing("draw", profileData.draws, profileData.drawNanoseconds);
+    out << ",\n";
+    timing("present", profileData.presents, profileData.presentNanoseconds);
+    out << "\n}\n";
+    return out.good();
+#else
+    std::cout << "Error: cannot write " << filename << ", this build does not profile (CHIP8_PROFILE)\n";
+    return false;
+#endif
+}
+
+
+
+
 //Opcode instructions
+/*
+Op Trap - shared handler for every opcode that does not decode to an instruction
+*/
+void Chip8::OpTrap() {
+    std::cout << "FATAL ERROR : BAD OPCODE 0x" << std::hex << inst->opcode << std::dec << std::endl;
+    if(trace != nullptr) trace->trap(registers);
+}
+
 /*
 */
 void Chip8::Op0nnn() {
-    uint16_t nnn = opcode & 0x0FFF;
+    uint16_t nnn = inst->nnn;
     PC = nnn;
 }
 
@@ -238,20 +1089,23 @@ Op 00E0 - Clears the display buffer
 */
 void Chip8::Op00E0 () {
     for(int i = 0; i < HEIGHT; i++)
-        for(int j = 0; j < WIDTH; j++)
-            DisplayBuffer[i][j] = false;
+        DisplayBuffer[i] = 0;
+
+    dirtyRows = Display::ALL_ROWS;
 }
 
 /*
 Op00EE - RET
 Returns from a subroutine, throws error if stack pointer is less than 0
+    SP wraps around the stack rather than leaving it, like I does around memory
 */
 void Chip8::Op00EE() {
     //SP < 1  ? throw "FATAL ERROR : NO RETURN ADDRESS IN MEMORY" : PC = RA_Stack[--SP];
     if(SP < 1) {
         std::cout << "ERROR : NO RETURN ADDRESS IN MEMORY!\n";
     }
-    PC = RA_Stack[--SP];
+    SP = (SP - 1) & (STACK_SIZE - 1);
+    PC = RA_Stack[SP];
 }
 
 
@@ -268,8 +1122,9 @@ Op 2nnn - Calls subroutine at address nnn
     thus we push then increment our stack pointer
 */
 void Chip8::Op2nnn() {
-    uint16_t nnn = opcode & 0x0FFF;
-    RA_Stack[SP++] = PC;
+    uint16_t nnn = inst->nnn;
+    RA_Stack[SP] = PC;
+    SP = (SP + 1) & (STACK_SIZE - 1);
     PC = nnn;
 }
 
@@ -279,8 +1134,8 @@ Compares  register Vx to kk, if they're equal than skip (PC+=2) the next
 instruction
 */
 void Chip8::Op3xkk(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t kk = opcode & 0x00FF;
+    uint8_t Vx = registers[inst->x];
+    uint8_t kk = inst->kk;
 
     if(Vx == kk) PC+=2;
 }
@@ -292,8 +1147,8 @@ instruction
 */
 void Chip8::Op4xkk(){
 
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t kk = opcode & 0x00FF;
+    uint8_t Vx = registers[inst->x];
+    uint8_t kk = inst->kk;
 
     if(Vx != kk) PC+=2;
 }
@@ -304,8 +1159,8 @@ Op 5xy0 - Skip Next instruction if Vx == Vy
 */
 void Chip8::Op5xy0(){
 
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
     if(Vx == Vy) PC+=2;
 
@@ -317,7 +1172,7 @@ Loads kk into Vx register
 */
 void Chip8::Op6xkk(){
     //Vx = kk
-    registers[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
+    registers[inst->x] = inst->kk;
 }
 
 /*
@@ -325,24 +1180,24 @@ Op 7xkk - Adds Vx and kk and stores value into Vx.
     Does not account for overflow
 */
 void Chip8::Op7xkk(){
-    registers[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
+    registers[inst->x] += inst->kk;
 }
 
 /*
 Op 8xy0 - Assigns Vx = Vy
 */
 void Chip8::Op8xy0(){
-    registers[(opcode & 0x0F00) >> 8] = registers[(opcode & 0x00F0) >> 4];
+    registers[inst->x] = registers[inst->y];
 }         //LD Vx, Vy
 
 /*
 Op 8xy1 - Assignns Vx = Vx OR Vy
 */
 void Chip8::Op8xy1(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
-    registers[(opcode & 0x0F00) >> 8] = Vx | Vy ;
+    registers[inst->x] = Vx | Vy ;
 }
 //OR Vx, Vy
 
@@ -350,20 +1205,20 @@ void Chip8::Op8xy1(){
 Op 8xy2 - Assigns Vx = Vx AND Vy
 */
 void Chip8::Op8xy2(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
-    registers[(opcode & 0x0F00) >> 8] = Vx & Vy;
+    registers[inst->x] = Vx & Vy;
 }
 
 /*
 Op 8xy3 - Assigns Vx = Vx XOR Vy
 */
 void Chip8::Op8xy3(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
-    registers[(opcode & 0x0F00) >> 8] = Vx ^ Vy;
+    registers[inst->x] = Vx ^ Vy;
 }
 
 /*
@@ -374,13 +1229,13 @@ void Chip8::Op8xy4(){
     uint16_t Vf_Vx;
 
     //operands Vx + Vy
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
 
     Vf_Vx = Vx + Vy;
 
-    registers[(opcode & 0x0F00) >> 8] = (Vf_Vx & 0x00FF); //Vx assignment
+    registers[inst->x] = (Vf_Vx & 0x00FF); //Vx assignment
 
     registers[0xF] = (Vf_Vx & 0x0F00) >> 8;               //Vf assignment
 
@@ -391,51 +1246,51 @@ Op 8xy5 - Assigns Vx = Vx - Vy , If Vx > Vy assign VF to 1, else 0 ;
 */
 void Chip8::Op8xy5(){
 
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
     Vx > Vy ? registers[0xF] = 1 : registers[0xF] = 0 ;
-    registers[(opcode & 0x0F00) >> 8 ] = Vx - Vy;
+    registers[inst->x ] = Vx - Vy;
 }
 
 //Shift Right Vx by 1, Vy not significant
 void Chip8::Op8xy6() {
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
 
     //check if LSB is 1, then set VF as carry out
     (Vx & 0x01) ? registers[0xF] = 1 : registers[0xF] = 0;
-    registers[(opcode & 0x0F00) >> 8] = Vx >> 1;
+    registers[inst->x] = Vx >> 1;
 }
 
 /*
 Op 8xy7 - Assigns Vx = Vy - Vx. If Vy > Vx, VF = 1, else VF = 0
 */
 void Chip8::Op8xy7(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
     //check if underflow, set 1 if true , else set 0
     Vy > Vx ? registers[0xF] = 1 : registers[0xF] = 0;
 
     //Vx = Vy - Vx;
-    registers[(opcode & 0x0F00) >> 8] = Vy - Vx;
+    registers[inst->x] = Vy - Vx;
 }         //SUBN Vx, Vy
 
 /*
 Op 8xyE - Shift Left Vx by 1, If it overflows, set VF to 1, else VF = 0
 */
 void Chip8::Op8xyE(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
     (Vx & 0x80) ? registers[0xF] = 1 : registers[0xF] = 0;  //Save overflow to VF
-    registers[(opcode & 0x0F00) >> 8] = Vx << 1;
+    registers[inst->x] = Vx << 1;
 }
 
 /*
 Op 9xy0 - Skip Next instruction (pc += 2 ) if Vx != Vy
 */
 void Chip8::Op9xy0(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4];
+    uint8_t Vx = registers[inst->x];
+    uint8_t Vy = registers[inst->y];
 
     if(Vx != Vy) PC+=2;
 
@@ -445,7 +1300,7 @@ void Chip8::Op9xy0(){
 Op Annn - Register I is set to nnn
 */
 void Chip8::OpAnnn(){
-    uint16_t nnn = opcode & 0x0FFF;
+    uint16_t nnn = inst->nnn;
     I = nnn;
 }
 
@@ -454,7 +1309,7 @@ Op Bnnn - Jumps to address nnn + V0 value
 */
 void Chip8::OpBnnn(){
     // PC = nnn + V0
-    PC = (opcode & 0x0FFF) + registers[0];
+    PC = inst->nnn + registers[0];
 }
 
 /*
@@ -462,7 +1317,7 @@ Op Cxkk - Vx = [random byte] & kk
 */
 void Chip8::OpCxkk(){
 
-    registers[(opcode & 0x0F00) >> 8] = (std::rand() & (opcode & 0x00FF));
+    registers[inst->x] = (nextRandom() & inst->kk);
 }
 
 /*
@@ -470,35 +1325,24 @@ Op Dxyn - Draw n-bytes of a sprite at position (Vx, Vy) located at address store
     on I
 */
 void Chip8::OpDxyn(){
+    CHIP8_PROFILE_SCOPE(draws, drawNanoseconds);
 
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8]; //x coord
-    uint8_t Vy = registers[(opcode & 0x00F0) >> 4]; //y coord
-    uint8_t n = opcode & 0x000F;                    //bytes to draw
-
-    uint8_t pixel = 0x80; // pixel to AND with our byte to draw to screen
-
+    uint8_t Vx = registers[inst->x] % WIDTH;    //x coord
+    uint8_t Vy = registers[inst->y];            //y coord
+    uint8_t n = inst->n;                        //bytes to draw
 
     registers[0xF] = 0; //reset flag to 0 as it will stand if we have sprite overlay
-    short offset = 0;
-
-    while(n>0) {
-        //if we have drawn the full byte, reset our x coord, increment our Y coord and
-        //memory pointer, and reset our pixel
-        if(pixel == 0) {
-            Vy += 1;
-            offset+=1;
-            pixel = 0x80;
-            Vx = registers[(opcode & 0x0F00) >> 8];
-            n--;
-        }
-        else {
-            if(DisplayBuffer[Vy % HEIGHT][Vx % WIDTH] && (MEMORY_BUFF[I+offset] & pixel))
-                registers[0xF] = 1;
 
-            DisplayBuffer[Vy % HEIGHT][Vx % WIDTH] ^= (bool)(MEMORY_BUFF[I+offset] & pixel);
-            Vx++;
-            pixel >>= 1;
-        }
+    for(uint8_t offset = 0; offset < n; offset++) {
+        //sprite byte in the top 8 bits, rotated right so pixels past the right edge wrap
+        //around to the left like they always have
+        uint64_t sprite = (uint64_t)MEMORY_BUFF[(I+offset) & (MEMORY_BUFF_SIZE - 1)] << 56;
+        sprite = (sprite >> Vx) | (sprite << ((WIDTH - Vx) % WIDTH));
+
+        uint8_t y = (Vy + offset) % HEIGHT;
+        if(DisplayBuffer[y] & sprite) registers[0xF] = 1;
+        DisplayBuffer[y] ^= sprite;
+        if(sprite) dirtyRows |= 1u << y;
     }
 
 }
@@ -508,7 +1352,7 @@ Op Ex9E - Skips the next instruction (PC+=2) if keypad with the value
           stored in Vx is currently pressed
 */
 void Chip8::OpEx9E(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x] & 0xF;   //only the low nibble names a key
 
     if(keypad[Vx]) PC+=2;
 }
@@ -517,7 +1361,7 @@ void Chip8::OpEx9E(){
 Op ExA1 - skips the next instruction if the value of Vx is NOT pressed
 */
 void Chip8::OpExA1(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x] & 0xF;
 
     if(!keypad[Vx]) PC +=2;
 }
@@ -526,7 +1370,7 @@ void Chip8::OpExA1(){
  Op Fx07 - Loads the value of the delay timer (DT) into
 */
 void Chip8::OpFx07() {
-    registers[(opcode & 0x0F00) >> 8] = delay_timer;
+    registers[inst->x] = delay_timer;
 }
 
 /*
@@ -537,7 +1381,7 @@ void Chip8::OpFx0A(){
     bool anyKeyPressed = false;
     for(uint8_t i = 0; i < 16; i++) {
         if(keypad[i]){
-            registers[(opcode & 0x0F00) >> 8] = i;
+            registers[inst->x] = i;
             anyKeyPressed = true;
         }
     }
@@ -548,7 +1392,7 @@ void Chip8::OpFx0A(){
 Op Fx15 - Set the Delay Timer to Vx
 */
 void Chip8::OpFx15(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
     delay_timer = Vx;
 }
 
@@ -556,7 +1400,7 @@ void Chip8::OpFx15(){
 Op Fx18 - Set the Sound Timer to Vx
 */
 void Chip8::OpFx18(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
     sound_timer = Vx;
 }
 
@@ -564,7 +1408,7 @@ void Chip8::OpFx18(){
 Op Fx1E - Assigns I = I + Vx
 */
 void Chip8::OpFx1E(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
     I += Vx;
 }
 
@@ -572,7 +1416,7 @@ void Chip8::OpFx1E(){
 Op Fx29 - Assigns I for the location of sprite for Digit in Vx
 */
 void Chip8::OpFx29(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
 
     //Digit sprites are 8x5 hence Vx * 5
     I = FONT_STARTING_ADDRESS + (Vx * 5);
@@ -587,10 +1431,13 @@ Op Fx33 - Stores Vx value in BCD Format. As Vx registers are 8 bit and are range
           I + 2  -> stores 1s digit
 */
 void Chip8::OpFx33(){
-    uint8_t Vx = registers[(opcode & 0x0F00) >> 8];
+    uint8_t Vx = registers[inst->x];
 
     for(int offset = 2; offset >= 0; offset--){
-        MEMORY_BUFF[I+offset] = Vx % 10;
+        uint16_t address = (I+offset) & (MEMORY_BUFF_SIZE - 1);    //I past the end wraps around
+        MEMORY_BUFF[address] = Vx % 10;
+        invalidate(address);
+        watchWrite(address);
         Vx /= 10;
     }
 }
@@ -599,11 +1446,14 @@ void Chip8::OpFx33(){
 Op Fx55 - Stores Register V0 through Vx (inclusive) in memory starting at I;
 */
 void Chip8::OpFx55(){
-    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t x = inst->x;
 
 
     for(uint8_t j = 0; j <= x; j++) {
-        MEMORY_BUFF[I+j] = registers[j];
+        uint16_t address = (I+j) & (MEMORY_BUFF_SIZE - 1);
+        MEMORY_BUFF[address] = registers[j];
+        invalidate(address);
+        watchWrite(address);
     }
 }
 
@@ -611,17 +1461,17 @@ void Chip8::OpFx55(){
 Op Fx65 - Loads from I to I+x into registers V0 - Vx (inclusive)
 */
 void Chip8::OpFx65(){
-    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t x = inst->x;
 
     for(uint8_t j = 0; j <= x; j++) {
-        registers[j] = MEMORY_BUFF[I+j];
+        registers[j] = MEMORY_BUFF[(I+j) & (MEMORY_BUFF_SIZE - 1)];
     }
 }
 
-void Chip8::decrementTimers(){
-    while(running) {
-        Sleep(16);
-        if(delay_timer > 0) delay_timer--;
-        if(sound_timer > 0) sound_timer--;
-    }
+/*
+Op Break - a breakpoint's slot: stops before the instruction underneath runs
+*/
+void Chip8::OpBreak(){
+    PC -= 2;
+    stop = STOP_BREAKPOINT;
 }
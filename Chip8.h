@@ -9,12 +9,27 @@
 #include <stdint.h>
 #include <cstdlib>
 #include <fstream>
+#include <iostream>
+#include <string>
 #include <chrono>
-#include <Windows.h>
-#include <thread>
 #include <sstream>
+#include <bitset>
+#include <memory>
 #include "font.h"
-#include "console_interface.h"
+#include "platform.h"
+#include "trace_buffer.h"
+
+
+class JitCompiler;
+class RewindBuffer;
+class ControlFlowGraph;
+
+
+//CHIP8_PROFILE=1 counts every instruction and times drawing, see Chip8::Profile. It changes the
+//layout of Chip8, so everything including this header has to agree on it
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
 
 
 /*
@@ -88,48 +103,198 @@ const unsigned int FONT_STARTING_ADDRESS = 0x50;
 const int HEIGHT = 32;
 const int WIDTH = 64;
 
+//Timing - the timers tick, input is polled and the display is presented once per frame
+const int FRAME_RATE = 60;
+const int DEFAULT_INSTRUCTIONS_PER_FRAME = 11;     //~660 instructions per second
+
 
 
 
 class Chip8{
+    friend class JitCompiler;
+    friend class AotCompiler;
+    friend struct AotRuntime;
+    friend class LockstepEngine;
+    friend class Debugger;
+    friend class ControlFlowGraph;
 public:
 
-    Chip8(const char * filename, int scale, int cyclemsDelay);
+    //every platform piece is optional, without them the machine runs headless through frame()
+    explicit Chip8(Display * display = nullptr, Input * input = nullptr, Audio * audio = nullptr, Timing * timing = nullptr);
     ~Chip8();
 
+    //the engines hold on to this machine's address, copy one through saveState/loadState instead
+    Chip8(const Chip8 &) = delete;
+    Chip8 & operator=(const Chip8 &) = delete;
+
 
     bool loadROM(std::string filename);
+    bool loadROM(const uint8_t * data, size_t size);
     static void loadFont(uint8_t * MEMORY_BUFF, int start_address, int size);
+    uint64_t romHash() const { return loadedROMHash; }     //FNV-1a of the loaded ROM's bytes
 
-    void run();
-    bool running = false;
+    //code, data and basic blocks of the loaded ROM - see control_flow.h. Recovered on the first
+    //call after loadROM, from memory as it is then, machines nobody asks never pay for it
+    const ControlFlowGraph & controlFlow() const;
 
-    //Display to draw to the screen to
-    bool ** DisplayBuffer = nullptr;
-    //bool DisplayBuffer[32][64] = {0};
+    void run();
+    void frame();
+    void setInstructionsPerFrame(int instructionsPerFrame);
+    void setTurbo(bool turbo, int presentRate = FRAME_RATE);
+    void setRunAhead(int frames);
+
+    //Throughput - measured by run() over the last second
+    struct Stats {
+        double instructionsPerSecond = 0;
+        double framesPerSecond = 0;
+        double presentsPerSecond = 0;
+        double runAheadMicroseconds = 0;    //average cost of one run-ahead present
+    };
+    const Stats & stats() const { return lastStats; }
+    uint64_t instructionsExecuted() const { return instructionCount; }
+
+    //Display to draw to the screen to - one row per uint64_t, the leftmost pixel in the top bit
+    uint64_t DisplayBuffer[HEIGHT] = {0};
+    uint32_t dirtyRows = 0;                 //bit y set when row y changed since the last present
     bool keypad[16] = {0}; // keypad to handle input
 
     //Timers - 60 Hz
     uint8_t delay_timer = 0;
     uint8_t sound_timer = 0;
-    void decrementTimers();     //maybe
-
 
-    //Display and Console interface
-    ConsoleInterface consoleInterface;
+    //Cxkk's random numbers - every machine has its own generator, the same seed gives the same bytes
+    static const uint64_t DEFAULT_RANDOM_SEED = 0x853C49E6748FEA9Bull;
+    void seedRandom(uint64_t seed);
+
+    //Save states - everything the machine runs on in one fixed size blob, in host byte order.
+    //Laid out without padding so two states of the same ROM can be compared byte for byte
+    static const uint32_t SAVE_STATE_MAGIC = 0x53533843;    //"C8SS"
+    static const uint16_t SAVE_STATE_VERSION = 2;
+    struct SaveState {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t PC;
+        uint16_t I;
+        uint16_t keys;                                      //bit k set while key k is held
+        uint16_t stack[STACK_SIZE];
+        uint8_t registers[16];
+        uint8_t SP;
+        uint8_t delayTimer;
+        uint8_t soundTimer;
+        uint8_t reserved;
+        uint64_t randomState;
+        uint64_t instructions;
+        uint64_t frames;
+        uint32_t frameProgress;                             //instructions into the frame, see step()
+        uint32_t padding;
+        uint64_t display[HEIGHT];
+        uint8_t memory[MEMORY_BUFF_SIZE];
+    };
+    void saveState(SaveState & state) const;
+    bool loadState(const SaveState & state);
+    bool loadState(const void * data, size_t size);         //a blob read back from a file
+
+
+    //Platform the machine runs on, see platform.h
+    Display * display;
+    Input * input;
+    Audio * audio;
+    Timing * timing;
+
+    //history run() records into every frame and steps back through while Input::rewinding()
+    void setRewindBuffer(RewindBuffer * rewindBuffer) { this->rewindBuffer = rewindBuffer; }
+
+    //every instruction goes into the trace while one is set, the JIT, ahead-of-time blocks and
+    //idle loop skipping are bypassed so none are missed. dumpTrace writes it out from the thread
+    //running the machine
+    void setTrace(TraceBuffer * trace) { this->trace = trace; }
+    bool dumpTrace(const std::string & filename);
+
+    //Debugging - a breakpoint stops execution before the instruction at its address runs, a
+    //watchpoint after an Fx33 or Fx55 has written to its address. A stopped frame() returns
+    //early and the next one carries on with the rest of its instructions. Breakpoints live in the
+    //pre-decode cache and watchpoints in the write paths, a machine without either runs as before
+    enum StopReason : uint8_t { STOP_NONE, STOP_BREAKPOINT, STOP_WATCHPOINT };
+    void setBreakpoint(uint16_t address, bool enabled = true);
+    void setWatchpoint(uint16_t address, bool enabled = true);
+    bool atBreakpoint() const { return breakpoints[PC & (MEMORY_BUFF_SIZE - 1)]; }  //one is set on the instruction at PC
+    StopReason stopReason() const { return stop; }
+    uint16_t watchpointHit() const { return watchHit; }
+    void step();                                        //runs the instruction at PC, breakpoint or not
+
+
+    //Ahead-of-time compiled blocks - installed by the translation units chip8aot generates
+    typedef void (*NativeBlock)(Chip8 & chip8);
+    struct NativeBlockEntry {
+        uint16_t address;                           //first instruction of the block
+        uint16_t length;                            //instructions in the block
+        NativeBlock block;
+    };
+    void setNativeBlocks(const NativeBlockEntry * entries, size_t count);
+
+
+    //Profiling - only collected in CHIP8_PROFILE builds, which always run the interpreter so no
+    //instruction goes uncounted. writeProfile fails in other builds
+    struct Profile {
+        uint64_t opcodes[256] = {0};                    //executions by handler, see opName
+        uint64_t addresses[MEMORY_BUFF_SIZE] = {0};     //executions by the address fetched from
+        uint64_t idleInstructions = 0;                  //done in bulk by skipIdle, not counted above
+        uint64_t draws = 0;
+        uint64_t drawNanoseconds = 0;                   //inside OpDxyn
+        uint64_t presents = 0;
+        uint64_t presentNanoseconds = 0;                //inside Display::renderDisplay
+    };
+#if CHIP8_PROFILE
+    const Profile & profile() const { return profileData; }
+#endif
+    bool writeProfile(const std::string & filename) const;
+    static const char * opName(uint8_t index);          //"Dxyn" style, "Trap" for bad opcodes
+    static const char * opcodeName(uint16_t opcode) { return opName(opTable[opcode]); }
 
 
 
 
 private:
 
-    //fetch decode execute cyle and the cycle delay
+    //fetch decode execute cyle and the instructions run each frame
     void cycle();
-    int delay = 0;
+    unsigned long execute(unsigned long budget);
+    unsigned long executeNative(unsigned long budget);
+    void fetch();
+
+    void tickTimers() {
+        if(delay_timer > 0) delay_timer--;
+        if(sound_timer > 0) sound_timer--;
+    }
+    int instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+
+    //turbo - frames run back to back, input and the display only every 1/presentRate seconds
+    static const int TURBO_FRAMES_PER_CHECK = 64;   //frames between looks at the clock
+    bool turbo = false;
+    int presentRate = FRAME_RATE;
+
+    //run-ahead - every present shows the machine runAheadFrames into the future, then rolls back
+    int runAheadFrames = 0;
+    uint64_t runAheadShown[HEIGHT] = {0};           //rows the last run-ahead present showed
+    bool presentedAhead = false;                    //the screen holds a run-ahead frame
+    std::chrono::nanoseconds runAheadTime{0};       //spent on run-ahead this stats window
+    uint64_t runAheadCount = 0;
+    void presentAhead();
+
+    RewindBuffer * rewindBuffer = nullptr;
+    void recordRewind();
+    void stepBack();
+
+    //counters behind stats()
+    uint64_t instructionCount = 0;
+    uint64_t frameCount = 0;
+    uint64_t presentCount = 0;
+    Stats lastStats;
+    void updateStats(double seconds, uint64_t instructions, uint64_t frames, uint64_t presents);
 
     //BUFFERS
     uint8_t MEMORY_BUFF [MEMORY_BUFF_SIZE] = {0};   //memory
-    uint16_t RA_Stack[STACK_SIZE];                  //Return Address Stack
+    uint16_t RA_Stack[STACK_SIZE] = {0};            //Return Address Stack
 
 
 
@@ -138,15 +303,111 @@ private:
     uint8_t SP = 0;                                     //Stack Pointer
     uint16_t PC = STARTING_ADDR;                        //Program Counter
     uint16_t I = 0;                                     //Memory Index Register - only 12 bit
+    uint64_t randomState = 0;                           //PCG32 state behind Cxkk
+
+
+    /*
+        nextRandom - PCG32 (XSH RR): a 64-bit LCG step, output permuted by an xorshift and a
+        rotate. No shared state, so machines on different threads never contend for it
+    */
+    uint32_t nextRandom() {
+        uint64_t state = randomState;
+        randomState = state * 6364136223846793005ull + 1442695040888963407ull;
+
+        uint32_t xorshifted = (uint32_t)(((state >> 18) ^ state) >> 27);
+        uint32_t rotation = (uint32_t)(state >> 59);
+        return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+    }
 
 
     //flag to get if rom loaded
     bool ROM_loaded = false;
+    uint64_t loadedROMHash = 0;
+    uint16_t loadedROMSize = 0;
+    static uint64_t hashBytes(const uint8_t * data, size_t size);
+    mutable std::unique_ptr<ControlFlowGraph> controlFlowGraph;    //built by controlFlow()
 
 
 
     //opcode and opcode functions
-    uint16_t opcode;
+    typedef void (*OpFunction)(Chip8 &);
+
+    //Pre-decoded instruction - handler and operands extracted from the opcode once
+    struct Instruction {
+        OpFunction handler = nullptr;       //nullptr marks an empty cache slot
+        uint16_t opcode = 0;
+        uint16_t nnn = 0;
+        uint8_t x = 0;
+        uint8_t y = 0;
+        uint8_t n = 0;
+        uint8_t kk = 0;
+        uint8_t index = 0;                  //OpIndex, used by the threaded dispatcher
+    };
+
+    //Pre-decode cache - one slot per even address, invalidated on every write to MEMORY_BUFF
+    static const unsigned int DECODE_CACHE_SIZE = MEMORY_BUFF_SIZE / 2;
+    Instruction decodeCache[DECODE_CACHE_SIZE];
+    Instruction scratch;                            //slot for instructions at odd addresses
+    const Instruction * inst = &scratch;            //instruction currently executing
+
+    static void decodeInstruction(uint16_t opcode, Instruction & instruction);
+    void decodeAt(uint16_t address, Instruction & slot);
+    void invalidate(uint16_t address);
+    void invalidateAll();
+
+    //Basic blocks - straight runs of pre-decode slots ending at a jump, call, return, skip or
+    //memory write. Used by the JIT, which drops every block when a write lands in codeMap
+    static const unsigned int MAX_BLOCK_LENGTH = 64;
+    std::bitset<MEMORY_BUFF_SIZE> codeMap;          //bytes covered by a translated block
+    JitCompiler * jit = nullptr;
+
+    //ahead-of-time blocks by start address, a block is dropped once a write lands inside it
+    const NativeBlockEntry * nativeBlocks[DECODE_CACHE_SIZE] = {};
+    const NativeBlockEntry * nativeEntries = nullptr;
+    size_t nativeCount = 0;
+    std::bitset<MEMORY_BUFF_SIZE> nativeMap;        //bytes covered by a block still in nativeBlocks
+    void mapNativeBlocks();
+
+    uint16_t translateBlock(uint16_t address);
+    void flushBlocks();
+    static bool endsBlock(uint8_t index);
+
+    //Idle loops - code that only burns instructions until a timer runs out or a key is pressed
+    enum IdleLoop : uint8_t {
+        IDLE_NONE,
+        IDLE_JUMP_SELF,                             //1nnn jumping to itself
+        IDLE_KEY_WAIT,                              //Fx0A
+        IDLE_TIMER_WAIT,                            //Fx07, 3x00, 1nnn back to the Fx07
+    };
+    IdleLoop idleLoopAt(uint16_t address) const;
+    unsigned long skipIdle(unsigned long budget);
+
+    //Every instruction handler in OpIndex order, expanded into the OpIndex enum, the handler
+    //table and the threaded dispatcher's label table so the three can never disagree
+    #define CHIP8_OP_LIST(OP)                                                               \
+        OP(Trap)    OP(0nnn)    OP(00E0)    OP(00EE)    OP(1nnn)    OP(2nnn)    OP(3xkk)    \
+        OP(4xkk)    OP(5xy0)    OP(6xkk)    OP(7xkk)    OP(8xy0)    OP(8xy1)    OP(8xy2)    \
+        OP(8xy3)    OP(8xy4)    OP(8xy5)    OP(8xy6)    OP(8xy7)    OP(8xyE)    OP(9xy0)    \
+        OP(Annn)    OP(Bnnn)    OP(Cxkk)    OP(Dxyn)    OP(Ex9E)    OP(ExA1)    OP(Fx07)    \
+        OP(Fx0A)    OP(Fx15)    OP(Fx18)    OP(Fx1E)    OP(Fx29)    OP(Fx33)    OP(Fx55)    \
+        OP(Fx65)    OP(Break)
+
+    #define CHIP8_OP_ENUM(name) OP_##name,
+    enum OpIndex : uint8_t { CHIP8_OP_LIST(CHIP8_OP_ENUM) OP_COUNT };
+    #undef CHIP8_OP_ENUM
+
+    //Dispatch table - every 16-bit opcode maps straight to its handler index, built once at
+    //startup. Handlers are plain function pointers (invoke<> wraps the member handler) so a
+    //dispatch is one load and one indirect call with the handler body inlined into the thunk
+    template<void (Chip8::*Op)()> static void invoke(Chip8 & chip8) { (chip8.*Op)(); }
+    static const unsigned int OPCODE_COUNT = 0x10000;
+    static const OpFunction opHandlers[OP_COUNT];
+    static uint8_t opTable[OPCODE_COUNT];
+    static const bool opTableBuilt;
+    static bool buildOpTable();
+    static OpIndex decode(uint16_t opcode);
+
+    void OpTrap ();                                 //Bad opcode
 
     void Op0nnn ();                                 //Sys Addr
     void Op00E0 ();                                 //CLS
@@ -184,6 +445,42 @@ private:
     void OpFx55 ();                                 //LD [I], Vx
     void OpFx65 ();                                 //LD Vx, [I]
 
+    void OpBreak ();                                //breakpoint, patched over a pre-decoded slot
+
+
+    TraceBuffer * trace = nullptr;
+    uint64_t traceCycle = 0;                        //instructionCount of the next one traced
+
+    std::bitset<MEMORY_BUFF_SIZE> breakpoints;
+    std::bitset<MEMORY_BUFF_SIZE> watchpoints;
+    bool debugging = false;                         //any breakpoint or watchpoint set
+    StopReason stop = STOP_NONE;
+    uint16_t watchHit = 0;
+    unsigned long frameProgress = 0;                //instructions the current frame has run
+    void watchWrite(uint16_t address) {
+        if(watchpoints[address & (MEMORY_BUFF_SIZE - 1)]) {
+            stop = STOP_WATCHPOINT;
+            watchHit = address & (MEMORY_BUFF_SIZE - 1);
+        }
+    }
+
+    //a breakpoint's slot is skipped by both hooks, step() records the instruction once it runs
+    void traceInstruction() {
+        if(trace != nullptr && inst->index != OP_Break) trace->record(traceCycle++, PC, inst->opcode, I, registers);
+    }
+
+    //counts the instruction inst points at, fetched from PC - nothing unless CHIP8_PROFILE
+    void profileInstruction() {
+#if CHIP8_PROFILE
+        if(inst->index == OP_Break) return;
+        profileData.opcodes[inst->index]++;
+        profileData.addresses[PC & (MEMORY_BUFF_SIZE - 1)]++;
+#endif
+    }
+#if CHIP8_PROFILE
+    Profile profileData;
+#endif
+
 
 
 };
@@ -0,0 +1,345 @@
+#include "Chip8.h"
+#include <map>
+#include <vector>
+#include <iomanip>
+
+
+/*
+AotCompiler - static recompiler for a single ROM.
+
+    Walks every block reachable from 0x200, following jumps, calls, the return site after
+    every call and both sides of every skip, and writes a C++ translation unit with one
+    function per block. Blocks end at the same instructions as the JIT's (Chip8::endsBlock).
+
+    The generated unit embeds the ROM and a main() that runs it on the normal Chip8 runtime
+    with the blocks installed through Chip8::setNativeBlocks. Anything the walk can't see -
+    Bnnn targets, 00EE into an address never called from, odd addresses and any block whose
+    bytes get overwritten at run time - is left to the interpreter.
+
+    Usage: chip8aot <rom file> <output.cpp>
+*/
+class AotCompiler {
+public:
+    bool loadROM(const std::string & filename);
+    void discover();
+    void write(std::ostream & out, const std::string & romName);
+
+private:
+    uint16_t opcodeAt(uint16_t address) const;
+    void writeBlock(std::ostream & out, uint16_t address, uint16_t length);
+
+    uint8_t memory[MEMORY_BUFF_SIZE] = {0};
+    std::vector<uint8_t> ROM;
+    std::map<uint16_t, uint16_t> blocks;            //start address -> instructions
+};
+
+
+
+/*
+    loadROM - reads the ROM into a scratch memory image laid out like Chip8's
+*/
+bool AotCompiler::loadROM(const std::string & filename) {
+    std::ifstream file(filename, std::ifstream::in | std::ifstream::binary);
+
+    if(!file.is_open()) {
+        std::cout << "Error: File Does not exist!\n";
+        return false;
+    }
+
+    ROM.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if(ROM.size() > MEMORY_BUFF_SIZE - STARTING_ADDR) {
+        std::cout << "Error: ROM File Size is too large!!!\n\n";
+        return false;
+    }
+
+    for(size_t i = 0; i < ROM.size(); i++)
+        memory[STARTING_ADDR + i] = ROM[i];
+
+    return true;
+}
+
+uint16_t AotCompiler::opcodeAt(uint16_t address) const {
+    return (memory[address] << 8) | memory[address + 1];
+}
+
+
+/*
+    hex - formats a value as a C++ hex literal
+*/
+static std::string hex(int value) {
+    std::stringstream ss;
+    ss << "0x" << std::hex << value;
+    return ss.str();
+}
+
+
+/*
+    discover - finds the start and length of every block reachable from STARTING_ADDR
+*/
+void AotCompiler::discover() {
+    const uint16_t ROMEnd = STARTING_ADDR + ROM.size();
+    std::vector<uint16_t> worklist = {STARTING_ADDR};
+
+    while(!worklist.empty()) {
+        uint16_t address = worklist.back();
+        worklist.pop_back();
+
+        //odd addresses and anything outside the ROM stay with the interpreter
+        if((address & 1) || address < STARTING_ADDR || address + 1 >= ROMEnd) continue;
+        if(blocks.count(address)) continue;
+
+        uint16_t pc = address;
+        uint16_t length = 0;
+        uint8_t index;
+        do {
+            index = Chip8::decode(opcodeAt(pc));
+            length++;
+            pc += 2;
+        } while(!Chip8::endsBlock(index) && pc + 1 < ROMEnd && length < Chip8::MAX_BLOCK_LENGTH);
+
+        blocks[address] = length;
+
+        //successors of the last instruction, pc is the address after it
+        uint16_t nnn = opcodeAt(pc - 2) & 0x0FFF;
+        switch(index) {
+            case Chip8::OP_0nnn:
+            case Chip8::OP_1nnn:
+                worklist.push_back(nnn);
+                break;
+
+            case Chip8::OP_2nnn:
+                worklist.push_back(nnn);
+                worklist.push_back(pc);             //where the 00EE will come back to
+                break;
+
+            case Chip8::OP_3xkk: case Chip8::OP_4xkk: case Chip8::OP_5xy0:
+            case Chip8::OP_9xy0: case Chip8::OP_Ex9E: case Chip8::OP_ExA1:
+                worklist.push_back(pc);
+                worklist.push_back(pc + 2);
+                break;
+
+            case Chip8::OP_Fx0A:
+                worklist.push_back(pc - 2);         //stalls on itself until a key is pressed
+                worklist.push_back(pc);
+                break;
+
+            //return addresses and V0 offsets are only known at run time
+            case Chip8::OP_00EE:
+            case Chip8::OP_Bnnn:
+                break;
+
+            default:
+                worklist.push_back(pc);
+                break;
+        }
+    }
+}
+
+
+/*
+    write - writes the generated translation unit
+*/
+void AotCompiler::write(std::ostream & out, const std::string & romName) {
+    out << "//\n// Generated by chip8aot from " << romName << " - do not edit\n//\n";
+    out << "#include \"Chip8.h\"\n\n\n";
+
+    //ROM image
+    out << "static const uint8_t ROM[" << ROM.size() << "] = {";
+    for(size_t i = 0; i < ROM.size(); i++) {
+        if(i % 16 == 0) out << "\n       ";
+        out << " 0x" << std::hex << std::setfill('0') << std::setw(2) << (int)ROM[i] << std::dec << std::setfill(' ') << ",";
+    }
+    out << "\n};\n\n\n";
+
+    //blocks
+    out << "struct AotRuntime {\n";
+    for(auto & block : blocks)
+        writeBlock(out, block.first, block.second);
+    out << "};\n\n\n";
+
+    out << "static const Chip8::NativeBlockEntry BLOCKS[] = {\n";
+    for(auto & block : blocks)
+        out << "    {" << hex(block.first) << ", " << block.second << ", &AotRuntime::block_" << std::hex << block.first << std::dec << "},\n";
+    out << "};\n\n\n";
+
+    out << "void installAotBlocks(Chip8 & chip8) {\n"
+           "    chip8.loadROM(ROM, sizeof(ROM));\n"
+           "    chip8.setNativeBlocks(BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0]));\n"
+           "}\n\n";
+
+    out << "#ifndef CHIP8_AOT_NO_MAIN\n"
+           "#include \"console_interface.h\"\n\n"
+           "int main(int argc, char *argv[]) {\n"
+           "    ConsoleInterface frontend(\"Chip-8\", WIDTH, HEIGHT, 15);\n"
+           "    RealTimeClock clock(FRAME_RATE);\n"
+           "    Chip8 console(&frontend, &frontend, &frontend, &clock);\n"
+           "    installAotBlocks(console);\n"
+           "    frontend.runEmulation([&] { console.run(); });\n"
+           "    return 0;\n"
+           "}\n"
+           "#endif\n";
+}
+
+
+/*
+    writeBlock - one static member function per block. Instructions are written out with the
+    same semantics as the Op handlers in Chip8.cpp, the ones that touch the display, keypad,
+    random numbers, the return stack or memory are run through Chip8::cycle instead.
+*/
+void AotCompiler::writeBlock(std::ostream & out, uint16_t address, uint16_t length) {
+    out << "    static void block_" << std::hex << address << std::dec << "(Chip8 & c) {\n";
+
+    for(uint16_t i = 0; i < length; i++) {
+        uint16_t pc = address + 2 * i;
+        uint16_t opcode = opcodeAt(pc);
+        uint16_t nnn = opcode & 0x0FFF;
+        int kk = opcode & 0x00FF;
+
+        const std::string Vx = "c.registers[" + hex((opcode & 0x0F00) >> 8) + "]";
+        const std::string Vy = "c.registers[" + hex((opcode & 0x00F0) >> 4) + "]";
+        const std::string VF = "c.registers[0xf]";
+
+        out << "        /* " << std::hex << std::setfill('0') << std::setw(3) << pc << ": "
+            << std::setw(4) << opcode << std::dec << std::setfill(' ') << " */ ";
+
+        uint8_t index = Chip8::decode(opcode);
+        switch(index) {
+            case Chip8::OP_0nnn:
+            case Chip8::OP_1nnn:
+                out << "c.PC = " << hex(nnn) << "; return;\n";
+                break;
+
+            case Chip8::OP_2nnn:
+                out << "c.RA_Stack[c.SP] = " << hex(pc + 2) << "; c.SP = (c.SP + 1) & (STACK_SIZE - 1); c.PC = " << hex(nnn) << "; return;\n";
+                break;
+
+            case Chip8::OP_3xkk:
+            case Chip8::OP_4xkk:
+            case Chip8::OP_5xy0:
+            case Chip8::OP_9xy0: {
+                std::string condition;
+                if(index == Chip8::OP_3xkk)      condition = Vx + " == " + hex(kk);
+                else if(index == Chip8::OP_4xkk) condition = Vx + " != " + hex(kk);
+                else if(index == Chip8::OP_5xy0) condition = Vx + " == " + Vy;
+                else                             condition = Vx + " != " + Vy;
+
+                out << "c.PC = (" << condition << ") ? " << hex(pc + 4) << " : " << hex(pc + 2) << "; return;\n";
+                break;
+            }
+
+            case Chip8::OP_6xkk:
+                out << Vx << " = " << hex(kk) << ";\n";
+                break;
+
+            case Chip8::OP_7xkk:
+                out << Vx << " += " << hex(kk) << ";\n";
+                break;
+
+            case Chip8::OP_8xy0:
+                out << Vx << " = " << Vy << ";\n";
+                break;
+
+            case Chip8::OP_8xy1:
+                out << Vx << " |= " << Vy << ";\n";
+                break;
+
+            case Chip8::OP_8xy2:
+                out << Vx << " &= " << Vy << ";\n";
+                break;
+
+            case Chip8::OP_8xy3:
+                out << Vx << " ^= " << Vy << ";\n";
+                break;
+
+            case Chip8::OP_8xy4:
+                out << "{ uint16_t sum = " << Vx << " + " << Vy << "; " << Vx << " = sum & 0xff; " << VF << " = sum >> 8; }\n";
+                break;
+
+            case Chip8::OP_8xy5:
+                out << "{ uint8_t vx = " << Vx << ", vy = " << Vy << "; " << VF << " = vx > vy; " << Vx << " = vx - vy; }\n";
+                break;
+
+            case Chip8::OP_8xy6:
+                out << "{ uint8_t vx = " << Vx << "; " << VF << " = vx & 1; " << Vx << " = vx >> 1; }\n";
+                break;
+
+            case Chip8::OP_8xy7:
+                out << "{ uint8_t vx = " << Vx << ", vy = " << Vy << "; " << VF << " = vy > vx; " << Vx << " = vy - vx; }\n";
+                break;
+
+            case Chip8::OP_8xyE:
+                out << "{ uint8_t vx = " << Vx << "; " << VF << " = vx >> 7; " << Vx << " = vx << 1; }\n";
+                break;
+
+            case Chip8::OP_Annn:
+                out << "c.I = " << hex(nnn) << ";\n";
+                break;
+
+            case Chip8::OP_Bnnn:
+                out << "c.PC = " << hex(nnn) << " + c.registers[0x0]; return;\n";
+                break;
+
+            case Chip8::OP_Fx07:
+                out << Vx << " = c.delay_timer;\n";
+                break;
+
+            case Chip8::OP_Fx15:
+                out << "c.delay_timer = " << Vx << ";\n";
+                break;
+
+            case Chip8::OP_Fx18:
+                out << "c.sound_timer = " << Vx << ";\n";
+                break;
+
+            case Chip8::OP_Fx1E:
+                out << "c.I += " << Vx << ";\n";
+                break;
+
+            case Chip8::OP_Fx29:
+                out << "c.I = " << hex(FONT_STARTING_ADDRESS) << " + " << Vx << " * 5;\n";
+                break;
+
+            //display, random numbers and register loads - the interpreter runs them in place
+            case Chip8::OP_00E0:
+            case Chip8::OP_Cxkk:
+            case Chip8::OP_Dxyn:
+            case Chip8::OP_Fx65:
+                out << "c.PC = " << hex(pc) << "; c.cycle();\n";
+                break;
+
+            //same, but they end the block
+            default:
+                out << "c.PC = " << hex(pc) << "; c.cycle(); return;\n";
+                break;
+        }
+    }
+
+    //block cut at MAX_BLOCK_LENGTH or the end of the ROM
+    if(!Chip8::endsBlock(Chip8::decode(opcodeAt(address + 2 * (length - 1)))))
+        out << "        c.PC = " << hex(address + 2 * length) << ";\n";
+
+    out << "    }\n\n";
+}
+
+
+
+int main(int argc, char *argv[]) {
+    if(argc != 3) {
+        std::cout << "Usage: chip8aot <rom file> <output.cpp>\n";
+        return 1;
+    }
+
+    AotCompiler compiler;
+    if(!compiler.loadROM(argv[1])) return 1;
+
+    compiler.discover();
+
+    std::ofstream out(argv[2]);
+    if(!out.is_open()) {
+        std::cout << "Error: could not open " << argv[2] << " for writing\n";
+        return 1;
+    }
+    compiler.write(out, argv[1]);
+
+    return 0;
+}
@@ -0,0 +1,271 @@
+#include "Chip8.h"
+#include "work_stealing_pool.h"
+#include <cctype>
+#include <iomanip>
+#include <vector>
+
+
+/*
+chip8batch - runs a list of ROMs headless on every core and writes one result line per ROM.
+
+    Usage: chip8batch <jobs file> <results.csv | results.json> [threads]
+
+    Jobs file, one job per line, blank lines and lines starting with # are skipped:
+        <rom> <input script | -> <instruction budget>
+
+    Input script, one change of the held keys per line:
+        <frame> <keys held from that frame on, as hex digits, - for none>
+    e.g. "120 5A" holds keys 5 and A from frame 120 until the next line.
+
+    Every job gets its own machine and runs whole frames until it has executed at least its
+    budget of instructions. The results hold the final framebuffer hash, the instructions
+    actually executed and the wall time.
+*/
+
+
+/*
+InputScript - replays a scripted keypad, one frame per recordInput call
+*/
+class InputScript : public Input {
+public:
+    bool load(const std::string & filename);
+    bool recordInput(bool * keypad) override;
+
+private:
+    struct Change {
+        uint64_t frame;
+        uint16_t keys;                      //bit k set while key k is held
+    };
+    std::vector<Change> changes;
+    size_t next = 0;
+    uint64_t frame = 0;
+    uint16_t held = 0;
+};
+
+
+bool InputScript::load(const std::string & filename) {
+    std::ifstream script(filename);
+    if(!script.is_open()) {
+        std::cout << "Error: input script " << filename << " does not exist!\n";
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(script, line)) {
+        std::istringstream fields(line);
+        Change change = {0, 0};
+        std::string keys;
+        if(line.empty() || line[0] == '#') continue;
+        if(!(fields >> change.frame >> keys)) {
+            std::cout << "Error: bad input script line in " << filename << ": " << line << "\n";
+            return false;
+        }
+
+        if(keys != "-") {
+            for(char key : keys) {
+                if(!std::isxdigit((unsigned char)key)) {
+                    std::cout << "Error: bad key '" << key << "' in " << filename << "\n";
+                    return false;
+                }
+                change.keys |= 1u << std::stoi(std::string(1, key), nullptr, 16);
+            }
+        }
+        changes.push_back(change);
+    }
+    return true;
+}
+
+
+bool InputScript::recordInput(bool * keypad) {
+    while(next < changes.size() && changes[next].frame <= frame)
+        held = changes[next++].keys;
+
+    for(int key = 0; key < 16; key++)
+        keypad[key] = (held >> key) & 1;
+
+    frame++;
+    return false;
+}
+
+
+
+
+struct Job {
+    std::string rom;
+    std::string script;                     //"-" for no input
+    uint64_t budget;
+};
+
+struct Result {
+    bool ok = false;
+    uint64_t framebufferHash = 0;
+    uint64_t instructions = 0;
+    uint64_t frames = 0;
+    double wallMilliseconds = 0;
+};
+
+
+/*
+readJobs - parses the jobs file
+    Return Value : false if the file is missing or a line is malformed
+*/
+static bool readJobs(const std::string & filename, std::vector<Job> & jobs) {
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+        std::cout << "Error: jobs file " << filename << " does not exist!\n";
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(file, line)) {
+        std::istringstream fields(line);
+        Job job;
+        lineNumber++;
+        if(line.empty() || line[0] == '#') continue;
+        if(!(fields >> job.rom >> job.script >> job.budget)) {
+            std::cout << "Error: " << filename << ":" << lineNumber << " should be <rom> <input script | -> <budget>\n";
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+
+/*
+hashFramebuffer - FNV-1a over the display rows
+*/
+static uint64_t hashFramebuffer(const Chip8 & console) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(int y = 0; y < HEIGHT; y++) {
+        for(int byte = 0; byte < 8; byte++) {
+            hash ^= (console.DisplayBuffer[y] >> (byte * 8)) & 0xFF;
+            hash *= 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+
+static Result runJob(const Job & job) {
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+
+    InputScript script;
+    Chip8 console(nullptr, &script);
+    if(job.script == "-" || script.load(job.script)) {
+        result.ok = console.loadROM(job.rom);
+
+        while(result.ok && console.instructionsExecuted() < job.budget) {
+            script.recordInput(console.keypad);
+            console.frame();
+            result.frames++;
+        }
+    }
+
+    result.framebufferHash = hashFramebuffer(console);
+    result.instructions = console.instructionsExecuted();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    result.wallMilliseconds = elapsed.count();
+    return result;
+}
+
+
+
+
+static std::string jsonString(const std::string & text) {
+    std::string quoted = "\"";
+    for(char c : text) {
+        if(c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static std::string csvField(const std::string & text) {
+    if(text.find_first_of(",\"\n") == std::string::npos) return text;
+
+    std::string quoted = "\"";
+    for(char c : text) {
+        if(c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+
+/*
+writeResults - CSV, or JSON when the file name ends in .json
+*/
+static bool writeResults(const std::string & filename, const std::vector<Job> & jobs, const std::vector<Result> & results) {
+    std::ofstream out(filename);
+    if(!out.is_open()) {
+        std::cout << "Error: cannot write " << filename << "\n";
+        return false;
+    }
+    bool json = filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0;
+
+    if(json) out << "[\n";
+    else out << "rom,input_script,budget,status,framebuffer_hash,instructions,frames,wall_ms\n";
+
+    for(size_t i = 0; i < jobs.size(); i++) {
+        std::ostringstream hash;
+        hash << std::hex << std::setw(16) << std::setfill('0') << results[i].framebufferHash;
+        const char * status = results[i].ok ? "ok" : "error";
+
+        if(json) {
+            out << "  {\"rom\": " << jsonString(jobs[i].rom)
+                << ", \"input_script\": " << jsonString(jobs[i].script)
+                << ", \"budget\": " << jobs[i].budget
+                << ", \"status\": \"" << status << "\""
+                << ", \"framebuffer_hash\": \"" << hash.str() << "\""
+                << ", \"instructions\": " << results[i].instructions
+                << ", \"frames\": " << results[i].frames
+                << ", \"wall_ms\": " << results[i].wallMilliseconds
+                << "}" << (i + 1 < jobs.size() ? ",\n" : "\n");
+        }
+        else {
+            out << csvField(jobs[i].rom) << ',' << csvField(jobs[i].script) << ',' << jobs[i].budget << ','
+                << status << ',' << hash.str() << ',' << results[i].instructions << ','
+                << results[i].frames << ',' << results[i].wallMilliseconds << '\n';
+        }
+    }
+
+    if(json) out << "]\n";
+    return true;
+}
+
+
+
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        std::cout << "Usage: chip8batch <jobs file> <results.csv | results.json> [threads]\n";
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    if(!readJobs(argv[1], jobs)) return 1;
+
+    std::vector<Result> results(jobs.size());
+    int threads = argc > 3 ? std::atoi(argv[3]) : 0;
+    WorkStealingPool pool(threads > 0 ? threads : 0);
+
+    auto start = std::chrono::steady_clock::now();
+    pool.run(jobs.size(), [&](size_t job) { results[job] = runJob(jobs[job]); });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if(!writeResults(argv[2], jobs, results)) return 1;
+
+    size_t failed = 0;
+    uint64_t instructions = 0;
+    for(const Result & result : results) {
+        if(!result.ok) failed++;
+        instructions += result.instructions;
+    }
+    std::cout << jobs.size() << " jobs on " << pool.threadCount() << " threads in " << elapsed.count() << " s, "
+              << instructions / elapsed.count() / 1e6 << " MIPS, " << failed << " failed\n";
+
+    return failed == 0 ? 0 : 2;
+}
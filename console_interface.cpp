@@ -30,13 +30,20 @@ ConsoleInterface::ConsoleInterface(const char * windowName, int WIDTH, int HEIGH
 
 
     //create window and renderer and make it an empty black screen.
-    SDL_CreateWindowAndRenderer(WIDTH*SCALE, HEIGHT*SCALE, 0, &gameWindow, &gameRenderer);
+    gameWindow = SDL_CreateWindow(windowName, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH*SCALE, HEIGHT*SCALE, 0);
+    createRenderer(0);
 
-    SDL_RenderSetScale(gameRenderer, SCALE, SCALE);
 
-    SDL_SetRenderDrawColor(gameRenderer, 0,0,0,255);
-    SDL_RenderClear(gameRenderer);
-    SDL_RenderPresent(gameRenderer);
+    //open the audio device paused, a machine without sound just stays silent
+    SDL_AudioSpec want = {}, have = {};
+    want.freq = 44100;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 512;
+    want.callback = audioCallback;
+    want.userdata = this;
+    audioDevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if(audioDevice != 0) sampleRate = have.freq;      //have is only filled in on success
 
 }
 
@@ -44,15 +51,155 @@ ConsoleInterface::ConsoleInterface(const char * windowName, int WIDTH, int HEIGH
     ~ConsoleInterface - Destructor that destroyws window + renderer and halts SDL subsystems
 */
 ConsoleInterface::~ConsoleInterface(){
-    SDL_DestroyRenderer(gameRenderer);
+    if(audioDevice != 0) SDL_CloseAudioDevice(audioDevice);
+    destroyRenderer();
     SDL_DestroyWindow(gameWindow);
     SDL_Quit();
 }
 
 /*
-    void RenderDisplay - display the current state of the displayArray to the window
+    void setTone - starts or stops the beep
+*/
+void ConsoleInterface::setTone(bool on) {
+    if(audioDevice == 0 || on == toneOn) return;
+
+    toneOn = on;
+    SDL_PauseAudioDevice(audioDevice, on ? 0 : 1);
+}
+
+/*
+    void audioCallback - fills SDL's buffer with a TONE_FREQUENCY square wave
+*/
+void ConsoleInterface::audioCallback(void * userdata, Uint8 * stream, int len) {
+    ConsoleInterface * console = (ConsoleInterface *)userdata;
+    int16_t * samples = (int16_t *)stream;
+    unsigned int halfPeriod = console->sampleRate / (2 * TONE_FREQUENCY);
+    if(halfPeriod == 0) halfPeriod = 1;
+
+    for(int i = 0; i < len / 2; i++) {
+        samples[i] = (console->samplePhase / halfPeriod) % 2 ? 3000 : -3000;
+        console->samplePhase = (console->samplePhase + 1) % (2 * halfPeriod);
+    }
+}
+
+/*
+    void createRenderer - creates the renderer and texture on the main thread, the only one SDL
+    lets use them, and clears the window to black
+*/
+void ConsoleInterface::createRenderer(Uint32 flags) {
+    gameRenderer = SDL_CreateRenderer(gameWindow, -1, flags);
+
+    SDL_RenderSetScale(gameRenderer, SCALE, SCALE);
+
+    //one texel per pixel, scaled up by the renderer. Without it we draw point by point
+    texture = SDL_CreateTexture(gameRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+    if(texture == nullptr) renderPath = RENDER_POINTS;
+
+    SDL_SetRenderDrawColor(gameRenderer, 0,0,0,255);
+    SDL_RenderClear(gameRenderer);
+    SDL_RenderPresent(gameRenderer);
+    redraw = true;
+}
+
+void ConsoleInterface::destroyRenderer() {
+    if(texture != nullptr) SDL_DestroyTexture(texture);
+    if(gameRenderer != nullptr) SDL_DestroyRenderer(gameRenderer);
+    texture = nullptr;
+    gameRenderer = nullptr;
+}
+
+/*
+    void runEmulation - starts emulation on a thread of its own and keeps the window on this one
+    until it returns: pumps events, draws the newest published frame, only the rows that differ
+    from the one on screen, and waits for vsync. With nothing new it sleeps for one refresh
+*/
+void ConsoleInterface::runEmulation(const std::function<void()> & emulation) {
+    destroyRenderer();
+    createRenderer(SDL_RENDERER_PRESENTVSYNC);
+
+    SDL_DisplayMode mode;
+    int refreshRate = 60;
+    if(SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(gameWindow), &mode) == 0 && mode.refresh_rate > 0)
+        refreshRate = mode.refresh_rate;
+    const auto refreshPeriod = std::chrono::nanoseconds(1000000000 / refreshRate);
+
+    emulating = true;
+    std::thread emulationThread([&] {
+        emulation();
+        emulating = false;
+    });
+
+    uint64_t shown[MAX_ROWS] = {0};                 //rows the texture holds
+    while(emulating) {
+        pumpEvents();
+        if(!frames.update() && !redraw) {
+            std::this_thread::sleep_for(refreshPeriod);
+            continue;
+        }
+
+        //frames we never got to are skipped, so diff against the screen rather than trusting
+        //the dirty rows of any one frame
+        const Frame & frame = frames.readBuffer();
+        uint32_t dirtyRows = 0;
+        for(int y = 0; y < HEIGHT; y++)
+            if(frame.rows[y] != shown[y]) {
+                dirtyRows |= 1u << y;
+                shown[y] = frame.rows[y];
+            }
+
+        draw(frame.rows, dirtyRows);
+    }
+    emulationThread.join();
+
+    //back to drawing straight from renderDisplay, without waiting for vsync
+    destroyRenderer();
+    createRenderer(0);
+}
+
+/*
+    void RenderDisplay - display the current state of the displayArray to the window, one
+    uint64_t per row with the leftmost pixel in the top bit. dirtyRows has bit y set for every
+    row that changed since the last call, with nothing changed there is nothing to present.
+    Called from runEmulation's thread it only publishes the frame for the main thread to draw
 */
-void ConsoleInterface::renderDisplay(bool ** buff) {
+void ConsoleInterface::renderDisplay(const uint64_t * buff, uint32_t dirtyRows) {
+    if(!emulating) {
+        draw(buff, dirtyRows);
+        return;
+    }
+
+    if(dirtyRows == 0) return;
+
+    Frame & frame = frames.writeBuffer();
+    for(int y = 0; y < HEIGHT; y++)
+        frame.rows[y] = buff[y];
+    frames.publish();
+}
+
+/*
+    void draw - draws the dirty rows and presents, main thread only
+*/
+void ConsoleInterface::draw(const uint64_t * buff, uint32_t dirtyRows) {
+    if(redraw) dirtyRows = ALL_ROWS;
+    redraw = false;
+    if(dirtyRows == 0) return;
+
+    if(renderPath == RENDER_TEXTURE) renderTexture(buff, dirtyRows);
+    else renderPoints(buff);
+}
+
+/*
+    void setRenderPath - picks the render path, the texture path needs the texture to exist
+*/
+void ConsoleInterface::setRenderPath(RenderPath path) {
+    renderPath = (path == RENDER_TEXTURE && texture == nullptr) ? RENDER_POINTS : path;
+    redraw = true;
+}
+
+/*
+    void renderPoints - clears the window and draws every lit pixel as a point
+*/
+void ConsoleInterface::renderPoints(const uint64_t * buff) {
     SDL_SetRenderDrawColor(gameRenderer,0,0,0, 255); //black
     SDL_RenderClear(gameRenderer);
     SDL_SetRenderDrawColor(gameRenderer, 255, 255, 255, 255); //white
@@ -60,13 +207,43 @@ void ConsoleInterface::renderDisplay(bool ** buff) {
     //set pixels from buffer
     for(int y = 0; y < HEIGHT; y++)
         for(int x = 0; x < WIDTH; x++) {
-            if(buff[y][x]) SDL_RenderDrawPoint(gameRenderer, x, y);
+            if(buff[y] & (1ull << (63 - x))) SDL_RenderDrawPoint(gameRenderer, x, y);
         }
 
     //present final state of renderer
     SDL_RenderPresent(gameRenderer);
 }
 
+/*
+    void renderTexture - expands the changed rows into the streaming texture, white for lit
+    pixels and black for the rest, and copies it over the whole window in one scaled draw.
+    Only the span from the first to the last dirty row is locked and uploaded
+*/
+void ConsoleInterface::renderTexture(const uint64_t * buff, uint32_t dirtyRows) {
+    int first = 0, last = HEIGHT - 1;
+    while(!(dirtyRows & (1u << first))) first++;
+    while(!(dirtyRows & (1u << last))) last--;
+
+    SDL_Rect span = {0, first, WIDTH, last - first + 1};
+    void * pixels;
+    int pitch;
+    if(SDL_LockTexture(texture, &span, &pixels, &pitch) != 0) {
+        renderPoints(buff);
+        return;
+    }
+
+    for(int y = first; y <= last; y++) {
+        uint32_t * row = (uint32_t *)((uint8_t *)pixels + (y - first) * pitch);
+        uint64_t bits = buff[y];
+        for(int x = 0; x < WIDTH; x++)
+            row[x] = 0xFF000000 | (0x00FFFFFF * (uint32_t)((bits >> (63 - x)) & 1));
+    }
+
+    SDL_UnlockTexture(texture);
+    SDL_RenderCopy(gameRenderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(gameRenderer);
+}
+
 /*
     bool ConsoleInterface::recordInput - stores the state of the keypad presses
     Arguments:
@@ -75,50 +252,70 @@ void ConsoleInterface::renderDisplay(bool ** buff) {
         Boolean:
             True - Stop Console
             False - Continue;
+    Description:
+        On runEmulation's thread the keys are the ones the main thread last saw, anywhere else
+        this pumps the events itself
 */
 bool ConsoleInterface::recordInput(bool * keypad) {
-    bool halt = false;
+    if(!emulating) pumpEvents();
+
+    uint16_t keys = heldKeys.load(std::memory_order_relaxed);
+    for(int i = 0; i < 16; i++)
+        keypad[i] = (keys >> i) & 1;
+
+    return quitRequested.exchange(false);
+}
+
+/*
+    void pumpEvents - handles every pending SDL event: keys, quitting and the window needing a
+    redraw. Main thread only
+*/
+void ConsoleInterface::pumpEvents() {
+    uint16_t keys = heldKeys.load(std::memory_order_relaxed);
     SDL_Event e;
 
     while(SDL_PollEvent(&e)) {
-        if(e.type == SDL_QUIT){
-            halt = true;
-        }
-
         switch(e.type) {
             case SDL_QUIT:
-                halt = true;
+                quitRequested = true;
                 break;
 
-            case SDL_KEYDOWN:
-                //dont count non mapped keys
-                if(e.key.keysym.sym == SDLK_ESCAPE) halt = true;
-                else if(e.key.keysym.sym != SDLK_0 && keypadMapping[e.key.keysym.sym] == 0 ) break;
-
-                //casting fixes ? lol
-                keypad[keypadMapping[e.key.keysym.sym]] = true;
-                    std::cout << std::hex <<  keypadMapping[e.key.keysym.sym] << std::endl;
-
-                for(int i = 0 ; i < 16; i++) {
+            //the window was uncovered or resized, the next present can't rely on what's on it
+            case SDL_WINDOWEVENT:
+                if(e.window.event == SDL_WINDOWEVENT_EXPOSED || e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                    redraw = true;
+                break;
 
-                    std::cout << keypad[i] << " ";
-                    if((i%4) == 3) std::cout << std::endl;
+            case SDL_KEYDOWN:
+                if(e.key.keysym.sym == SDLK_BACKSPACE) {
+                    rewindHeld = true;
+                    break;
                 }
 
+                //dont count non mapped keys
+                if(e.key.keysym.sym == SDLK_ESCAPE) {
+                    quitRequested = true;
+                    break;
+                }
+                else if(e.key.keysym.sym != SDLK_0 && keypadMapping[e.key.keysym.sym] == 0 ) break;
 
+                keys |= 1 << keypadMapping[e.key.keysym.sym];
                 break;
 
 
             case SDL_KEYUP:
-                    std::cout << std::hex << keypadMapping[e.key.keysym.sym] << std::endl;
+                if(e.key.keysym.sym == SDLK_BACKSPACE) {
+                    rewindHeld = false;
+                    break;
+                }
 
                 //Don't count non mapped keys
                 if(e.key.keysym.sym != SDLK_0 && keypadMapping[e.key.keysym.sym] == 0 ) break;
 
-                keypad[keypadMapping[e.key.keysym.sym]] = false;
+                keys &= ~(1 << keypadMapping[e.key.keysym.sym]);
                 break;
         }
 
     }
-    return halt;
-}
\ No newline at end of file
+    heldKeys.store(keys, std::memory_order_relaxed);
+}
@@ -6,8 +6,15 @@
 #define SDLTEST_CONSOLE_INTERFACE_H
 
 #include <iostream>
+#include <cstdint>
+#include <functional>
 #include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <atomic>
 #include <SDL2/SDL.h>
+#include "platform.h"
+#include "triple_buffer.h"
 
 
 
@@ -45,17 +52,72 @@ static std::unordered_map<int, int> keypadMapping = {
 
 
 
-class ConsoleInterface{
+/*
+ConsoleInterface - SDL frontend, the window is the Display, the keyboard the Input and a square
+    wave on the default audio device the Audio.
+
+    SDL wants the window, renderer and event pump on the main thread, so runEmulation() keeps
+    them there and moves the emulation loop onto a thread of its own instead. While it runs,
+    renderDisplay only publishes frames and recordInput only reads the keys the main thread saw.
+*/
+class ConsoleInterface : public Display, public Input, public Audio {
 public:
+    //how renderDisplay gets pixels to the window
+    enum RenderPath {
+        RENDER_POINTS,      //one SDL_RenderDrawPoint per lit pixel
+        RENDER_TEXTURE,     //expand into a streaming texture, one scaled SDL_RenderCopy
+    };
+
     ConsoleInterface(const char * windowName, int WIDTH, int HEIGHT, int SCALE);
     ~ConsoleInterface();
-    void renderDisplay(bool ** buff);
-    bool recordInput(bool * keypad);
+    void renderDisplay(const uint64_t * buff, uint32_t dirtyRows = ALL_ROWS) override;
+    bool recordInput(bool * keypad) override;
+    bool rewinding() override { return rewindHeld; }   //Backspace held
+    void setTone(bool on) override;
+    void setRenderPath(RenderPath path);            //not while runEmulation runs
+
+    /*
+        runEmulation - runs emulation, e.g. Chip8::run, on a thread of its own until it returns.
+        The calling thread, which must be the main thread, pumps events and draws the frames
+        meanwhile
+    */
+    void runEmulation(const std::function<void()> & emulation);
 
 private:
+    void createRenderer(Uint32 flags);
+    void destroyRenderer();
+    void draw(const uint64_t * buff, uint32_t dirtyRows);
+    void renderPoints(const uint64_t * buff);
+    void renderTexture(const uint64_t * buff, uint32_t dirtyRows);
+    void pumpEvents();
+
     SDL_Window * gameWindow = nullptr;
-    SDL_Renderer * gameRenderer = nullptr;
-    //SDL_Texture * texture = nullptr;
+    SDL_Renderer * gameRenderer = nullptr;          //main thread only, like the window
+    SDL_Texture * texture = nullptr;                //WIDTH x HEIGHT ARGB8888, streaming
+    RenderPath renderPath = RENDER_TEXTURE;
+    bool redraw = true;                             //window contents lost, draw every row
+
+    //Input - written by pumpEvents on the main thread, read by recordInput wherever it runs
+    std::atomic<uint16_t> heldKeys{0};              //bit k set while key k is held
+    std::atomic<bool> quitRequested{false};
+    std::atomic<bool> rewindHeld{false};
+
+    //Emulation thread - renderDisplay publishes frames, the main thread draws the newest one at
+    //the display's refresh rate so a slow present never holds up emulation
+    static const int MAX_ROWS = 32;                 //one bit per row in a dirty mask
+    struct Frame {
+        uint64_t rows[MAX_ROWS];
+    };
+    TripleBuffer<Frame> frames;
+    std::atomic<bool> emulating{false};             //set while runEmulation's thread runs
+
+    //Audio - square wave written by SDL's audio thread, paused while the tone is off
+    static const int TONE_FREQUENCY = 440;
+    static void audioCallback(void * userdata, Uint8 * stream, int len);
+    SDL_AudioDeviceID audioDevice = 0;
+    int sampleRate = 0;
+    unsigned int samplePhase = 0;                   //audio thread only
+    bool toneOn = false;
 
     int WIDTH;
     int HEIGHT;
@@ -0,0 +1,308 @@
+#include "control_flow.h"
+#include "Chip8.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+
+/*
+    hex - formats value as 0x and at least digits hex digits
+*/
+static std::string hex(unsigned int value, int digits) {
+    std::stringstream ss;
+    ss << "0x" << std::hex << std::setw(digits) << std::setfill('0') << value;
+    return ss.str();
+}
+
+
+void ControlFlowGraph::analyze(const uint8_t * memory, uint16_t romStart, uint16_t romEnd) {
+    image.assign(memory, memory + MEMORY_BUFF_SIZE);
+    start = romStart;
+    end = std::min<uint16_t>(romEnd, MEMORY_BUFF_SIZE);
+    code.assign(MEMORY_BUFF_SIZE, false);
+    blockMap.clear();
+
+    //every instruction reachable from the entry, and the ones starting a block
+    std::vector<bool> instruction(MEMORY_BUFF_SIZE, false), branches(MEMORY_BUFF_SIZE, false), leader(MEMORY_BUFF_SIZE, false);
+    std::vector<uint16_t> worklist;
+    if(inROM(start)) {
+        worklist.push_back(start);
+        leader[start] = true;
+    }
+
+    Block scratch;
+    while(!worklist.empty()) {
+        uint16_t address = worklist.back();
+        worklist.pop_back();
+        if(instruction[address]) continue;
+
+        instruction[address] = true;
+        code[address] = code[address + 1] = true;
+
+        scratch.successors.clear();
+        successorsOf(address, scratch);
+        branches[address] = scratch.exit != EXIT_EDGES || scratch.successors.size() != 1 || scratch.successors[0].kind != EDGE_NEXT;
+
+        for(const Edge & edge : scratch.successors) {
+            if(!inROM(edge.target)) continue;
+            if(branches[address]) leader[edge.target] = true;
+            worklist.push_back(edge.target);
+        }
+    }
+
+    //a block runs from a leader, or an instruction nothing falls into, to the next branch or leader
+    for(unsigned int address = start; address + 1 < end; address++) {
+        if(!instruction[address]) continue;
+        bool fallenInto = address >= start + 2u && instruction[address - 2] && !branches[address - 2];
+        if(fallenInto && !leader[address]) continue;
+
+        Block block{(uint16_t)address, 0, 0, EXIT_EDGES, {}};
+        uint16_t pc = address;
+        while(true) {
+            block.instructions++;
+            if(branches[pc] || !inROM(pc + 2) || leader[pc + 2]) break;
+            pc += 2;
+        }
+        successorsOf(pc, block);
+        block.end = pc + 2;
+        blockMap[block.start] = block;
+    }
+}
+
+
+/*
+    successorsOf - adds where the instruction at address can go next to block's successors and
+    sets its exit
+*/
+void ControlFlowGraph::successorsOf(uint16_t address, Block & block) const {
+    uint16_t opcode = opcodeAt(address);
+    uint16_t nnn = opcode & 0x0FFF;
+    uint16_t next = address + 2;
+    block.exit = EXIT_EDGES;
+
+    switch(Chip8::decode(opcode)) {
+        case Chip8::OP_0nnn:
+        case Chip8::OP_1nnn:
+            block.successors.push_back(Edge{nnn, EDGE_JUMP});
+            break;
+
+        case Chip8::OP_2nnn:
+            block.successors.push_back(Edge{nnn, EDGE_CALL});
+            block.successors.push_back(Edge{next, EDGE_RETURN});
+            break;
+
+        case Chip8::OP_3xkk: case Chip8::OP_4xkk: case Chip8::OP_5xy0:
+        case Chip8::OP_9xy0: case Chip8::OP_Ex9E: case Chip8::OP_ExA1:
+            block.successors.push_back(Edge{next, EDGE_NEXT});
+            block.successors.push_back(Edge{(uint16_t)(next + 2), EDGE_SKIP});
+            break;
+
+        case Chip8::OP_Fx0A:
+            block.successors.push_back(Edge{address, EDGE_WAIT});
+            block.successors.push_back(Edge{next, EDGE_NEXT});
+            break;
+
+        case Chip8::OP_00EE:
+            block.exit = EXIT_RETURN;
+            break;
+
+        case Chip8::OP_Bnnn:
+            block.exit = EXIT_INDIRECT;
+            break;
+
+        default:                                        //bad opcodes too, the interpreter carries on past them
+            block.successors.push_back(Edge{next, EDGE_NEXT});
+            break;
+    }
+}
+
+
+const ControlFlowGraph::Block * ControlFlowGraph::blockAt(uint16_t address) const {
+    //blocks of the same parity never overlap, the nearest one starting at or before address decides
+    for(auto block = blockMap.upper_bound(address); block != blockMap.begin();) {
+        --block;
+        if(((address - block->first) & 1) != 0) continue;
+        return address < block->second.end ? &block->second : nullptr;
+    }
+    return nullptr;
+}
+
+
+
+
+std::string ControlFlowGraph::disassemble(uint16_t opcode) {
+    std::string Vx = std::string("V") + "0123456789ABCDEF"[(opcode >> 8) & 0x0F];
+    std::string Vy = std::string("V") + "0123456789ABCDEF"[(opcode >> 4) & 0x0F];
+    std::string nnn = hex(opcode & 0x0FFF, 3);
+    std::string kk = hex(opcode & 0x00FF, 2);
+
+    switch(Chip8::decode(opcode)) {
+        case Chip8::OP_0nnn: return "SYS " + nnn;
+        case Chip8::OP_00E0: return "CLS";
+        case Chip8::OP_00EE: return "RET";
+        case Chip8::OP_1nnn: return "JP " + nnn;
+        case Chip8::OP_2nnn: return "CALL " + nnn;
+        case Chip8::OP_3xkk: return "SE " + Vx + ", " + kk;
+        case Chip8::OP_4xkk: return "SNE " + Vx + ", " + kk;
+        case Chip8::OP_5xy0: return "SE " + Vx + ", " + Vy;
+        case Chip8::OP_6xkk: return "LD " + Vx + ", " + kk;
+        case Chip8::OP_7xkk: return "ADD " + Vx + ", " + kk;
+        case Chip8::OP_8xy0: return "LD " + Vx + ", " + Vy;
+        case Chip8::OP_8xy1: return "OR " + Vx + ", " + Vy;
+        case Chip8::OP_8xy2: return "AND " + Vx + ", " + Vy;
+        case Chip8::OP_8xy3: return "XOR " + Vx + ", " + Vy;
+        case Chip8::OP_8xy4: return "ADD " + Vx + ", " + Vy;
+        case Chip8::OP_8xy5: return "SUB " + Vx + ", " + Vy;
+        case Chip8::OP_8xy6: return "SHR " + Vx;
+        case Chip8::OP_8xy7: return "SUBN " + Vx + ", " + Vy;
+        case Chip8::OP_8xyE: return "SHL " + Vx;
+        case Chip8::OP_9xy0: return "SNE " + Vx + ", " + Vy;
+        case Chip8::OP_Annn: return "LD I, " + nnn;
+        case Chip8::OP_Bnnn: return "JP V0, " + nnn;
+        case Chip8::OP_Cxkk: return "RND " + Vx + ", " + kk;
+        case Chip8::OP_Dxyn: return "DRW " + Vx + ", " + Vy + ", " + std::to_string(opcode & 0x0F);
+        case Chip8::OP_Ex9E: return "SKP " + Vx;
+        case Chip8::OP_ExA1: return "SKNP " + Vx;
+        case Chip8::OP_Fx07: return "LD " + Vx + ", DT";
+        case Chip8::OP_Fx0A: return "LD " + Vx + ", K";
+        case Chip8::OP_Fx15: return "LD DT, " + Vx;
+        case Chip8::OP_Fx18: return "LD ST, " + Vx;
+        case Chip8::OP_Fx1E: return "ADD I, " + Vx;
+        case Chip8::OP_Fx29: return "LD F, " + Vx;
+        case Chip8::OP_Fx33: return "LD B, " + Vx;
+        case Chip8::OP_Fx55: return "LD [I], " + Vx;
+        case Chip8::OP_Fx65: return "LD " + Vx + ", [I]";
+        default: return "DW " + hex(opcode, 4);
+    }
+}
+
+const char * ControlFlowGraph::edgeName(EdgeKind kind) {
+    static const char * const names[] = {"next", "skip", "jump", "call", "return", "wait"};
+    return names[kind];
+}
+
+
+
+
+void ControlFlowGraph::writeListing(std::ostream & out) const {
+    //data between the blocks, eight bytes a line
+    auto data = [this, &out](unsigned int from, unsigned int to) {
+        for(unsigned int address = from; address < to; address += 8) {
+            out << hex(address, 3) << "  data ";
+            for(unsigned int i = address; i < to && i < address + 8; i++)
+                out << " " << std::hex << std::setw(2) << std::setfill('0') << (int)image[i] << std::dec;
+            out << "\n";
+        }
+    };
+
+    unsigned int covered = start;
+    for(const auto & entry : blockMap) {
+        const Block & block = entry.second;
+        if(block.start > covered) data(covered, block.start);
+
+        out << "\n" << hex(block.start, 3) << ":\n";
+        for(uint16_t pc = block.start; pc < block.end; pc += 2)
+            out << hex(pc, 3) << "  " << hex(opcodeAt(pc), 4).substr(2) << "  " << disassemble(opcodeAt(pc)) << "\n";
+
+        out << "      ->";
+        for(const Edge & edge : block.successors)
+            out << " " << hex(edge.target, 3) << " (" << edgeName(edge.kind) << ")";
+        if(block.exit == EXIT_RETURN) out << " caller";
+        if(block.exit == EXIT_INDIRECT) out << " V0 + " << hex(opcodeAt(block.end - 2) & 0x0FFF, 3);
+        out << "\n";
+        covered = std::max<unsigned int>(covered, block.end);
+    }
+    if(end > covered) data(covered, end);
+}
+
+
+/*
+    writeDot - the graph for Graphviz, one box per block holding its disassembly. Targets
+    outside the ROM are dashed
+    Return Value : false if the file cannot be written
+*/
+bool ControlFlowGraph::writeDot(const std::string & filename) const {
+    std::ofstream out(filename);
+    if(!out.is_open()) {
+        std::cout << "Error: cannot write " << filename << "\n";
+        return false;
+    }
+
+    std::vector<uint16_t> outside;
+    out << "digraph rom {\n    node [shape=box, fontname=\"monospace\"];\n";
+    for(const auto & entry : blockMap) {
+        const Block & block = entry.second;
+        out << "    \"" << hex(block.start, 3) << "\" [label=\"";
+        for(uint16_t pc = block.start; pc < block.end; pc += 2)
+            out << hex(pc, 3) << "  " << disassemble(opcodeAt(pc)) << "\\l";
+        out << "\"];\n";
+
+        for(const Edge & edge : block.successors) {
+            out << "    \"" << hex(block.start, 3) << "\" -> \"" << hex(edge.target, 3) << "\" [label=\"" << edgeName(edge.kind) << "\"];\n";
+            if(!inROM(edge.target)) outside.push_back(edge.target);
+        }
+    }
+
+    std::sort(outside.begin(), outside.end());
+    outside.erase(std::unique(outside.begin(), outside.end()), outside.end());
+    for(uint16_t target : outside)
+        out << "    \"" << hex(target, 3) << "\" [label=\"" << hex(target, 3) << " outside the ROM\", style=dashed];\n";
+    out << "}\n";
+    return out.good();
+}
+
+
+/*
+    writeJSON - the blocks with their instructions and successors, and the data ranges
+    Return Value : false if the file cannot be written
+*/
+bool ControlFlowGraph::writeJSON(const std::string & filename) const {
+    std::ofstream out(filename);
+    if(!out.is_open()) {
+        std::cout << "Error: cannot write " << filename << "\n";
+        return false;
+    }
+
+    size_t codeBytes = 0;
+    for(unsigned int address = start; address < end; address++) codeBytes += code[address];
+
+    out << "{\n  \"entry\": \"" << hex(start, 3) << "\",\n  \"end\": \"" << hex(end, 3) << "\",\n"
+        << "  \"code_bytes\": " << codeBytes << ",\n  \"data_bytes\": " << (end - start) - codeBytes << ",\n";
+
+    static const char * const exits[] = {"edges", "return", "indirect"};
+    out << "  \"blocks\": [";
+    bool firstBlock = true;
+    for(const auto & entry : blockMap) {
+        const Block & block = entry.second;
+        out << (firstBlock ? "\n" : ",\n") << "    {\"start\": \"" << hex(block.start, 3) << "\", \"end\": \"" << hex(block.end, 3)
+            << "\", \"instructions\": " << block.instructions << ", \"exit\": \"" << exits[block.exit] << "\",\n      \"successors\": [";
+        for(size_t i = 0; i < block.successors.size(); i++)
+            out << (i ? ", " : "") << "{\"target\": \"" << hex(block.successors[i].target, 3) << "\", \"kind\": \""
+                << edgeName(block.successors[i].kind) << "\"}";
+        out << "],\n      \"code\": [";
+        for(uint16_t pc = block.start; pc < block.end; pc += 2)
+            out << (pc != block.start ? ", " : "") << "{\"address\": \"" << hex(pc, 3) << "\", \"opcode\": \""
+                << hex(opcodeAt(pc), 4).substr(2) << "\", \"text\": \"" << disassemble(opcodeAt(pc)) << "\"}";
+        out << "]}";
+        firstBlock = false;
+    }
+    out << "\n  ],\n";
+
+    out << "  \"data\": [";
+    bool firstRange = true;
+    for(unsigned int address = start; address < end;) {
+        if(code[address]) {
+            address++;
+            continue;
+        }
+        unsigned int rangeEnd = address;
+        while(rangeEnd < end && !code[rangeEnd]) rangeEnd++;
+        out << (firstRange ? "\n" : ",\n") << "    {\"start\": \"" << hex(address, 3) << "\", \"end\": \"" << hex(rangeEnd, 3) << "\"}";
+        firstRange = false;
+        address = rangeEnd;
+    }
+    out << "\n  ]\n}\n";
+    return out.good();
+}
@@ -0,0 +1,87 @@
+#ifndef SDLTEST_CONTROL_FLOW_H
+#define SDLTEST_CONTROL_FLOW_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/*
+ControlFlowGraph - the code of a ROM, recovered statically: which bytes are instructions and
+    which are data, and the basic blocks those instructions form.
+
+    Every instruction reachable from the entry point is visited, following fall through, jumps,
+    calls and the return site after each call, both sides of every skip and Fx0A's wait on
+    itself. Bytes never reached are data. A block starts at the entry, at any branch target
+    and after any instruction that branches, and ends at the next branch or block start, so
+    blocks never overlap.
+
+    Built by Chip8::controlFlow() on first use, engines that work a block at a time can take
+    their boundaries from here instead of finding them while the ROM runs. What cannot be known
+    without running it is left open: 00EE and Bnnn end a block with no successors, and code a
+    ROM writes at run time is not seen. Targets outside the ROM become edges to nowhere.
+*/
+class ControlFlowGraph {
+public:
+    enum EdgeKind : uint8_t {
+        EDGE_NEXT,                                      //falls through, or the skip not taken
+        EDGE_SKIP,                                      //skip taken
+        EDGE_JUMP,                                      //1nnn, 0nnn
+        EDGE_CALL,                                      //2nnn to the subroutine
+        EDGE_RETURN,                                    //2nnn to the return site, via the 00EE
+        EDGE_WAIT                                       //Fx0A spinning until a key is pressed
+    };
+    enum Exit : uint8_t {
+        EXIT_EDGES,                                     //all successors known
+        EXIT_RETURN,                                    //00EE
+        EXIT_INDIRECT                                   //Bnnn, V0 picks the target
+    };
+
+    struct Edge {
+        uint16_t target;
+        EdgeKind kind;
+    };
+    struct Block {
+        uint16_t start;
+        uint16_t end;                                   //one past its last byte
+        uint16_t instructions;
+        Exit exit;
+        std::vector<Edge> successors;
+    };
+
+    /*
+        analyze - rebuilds the graph for the ROM at memory[romStart, romEnd), memory being a
+        whole MEMORY_BUFF image and romStart the entry point
+    */
+    void analyze(const uint8_t * memory, uint16_t romStart, uint16_t romEnd);
+
+    const std::map<uint16_t, Block> & blocks() const { return blockMap; }
+    const Block * blockAt(uint16_t address) const;      //the block holding the instruction at address
+    bool isCode(uint16_t address) const { return address < code.size() && code[address]; }
+    uint16_t romStart() const { return start; }
+    uint16_t romEnd() const { return end; }
+
+    //"LD V1, 0x05" style, Cowgod's mnemonics
+    static std::string disassemble(uint16_t opcode);
+    static const char * edgeName(EdgeKind kind);
+
+    //the whole ROM in address order, blocks disassembled and data as bytes
+    void writeListing(std::ostream & out) const;
+    bool writeDot(const std::string & filename) const;
+    bool writeJSON(const std::string & filename) const;
+
+private:
+    uint16_t opcodeAt(uint16_t address) const { return (image[address] << 8) | image[address + 1]; }
+    bool inROM(uint16_t address) const { return address >= start && address + 1 < end; }
+    void successorsOf(uint16_t address, Block & block) const;
+
+    std::vector<uint8_t> image;                         //copy of the memory analyzed
+    uint16_t start = 0;
+    uint16_t end = 0;
+    std::vector<bool> code;                             //by byte
+    std::map<uint16_t, Block> blockMap;                 //by start address
+};
+
+#endif //SDLTEST_CONTROL_FLOW_H
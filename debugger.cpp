@@ -0,0 +1,239 @@
+#include "Chip8.h"
+#include "control_flow.h"
+#include "timeline.h"
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <sstream>
+
+
+/*
+chip8dbg - runs a ROM headless under a command line debugger.
+
+    Usage: chip8dbg <rom>
+
+    Addresses and keys are hex, step, frame and byte counts decimal, type h for the commands.
+    A command whose arguments don't parse prints the commands instead of running. Execution stops at breakpoints before
+    the instruction at their address runs and at watchpoints once an Fx33 or Fx55 has written
+    to their address; nothing is printed from inside the core, so the ROM runs at full speed up
+    to the stop. rs and rc run backwards through a Timeline of the session.
+*/
+
+
+/*
+Debugger - reads commands and drives one machine with them
+*/
+class Debugger {
+public:
+    explicit Debugger(Chip8 & chip8) : chip8(chip8), timeline(chip8) {}
+
+    //runs commands until q or the end of input
+    void run(std::istream & in, std::ostream & out);
+
+private:
+    bool command(const std::string & line, std::ostream & out);
+
+    void showInstruction(std::ostream & out) const;
+    void showStop(std::ostream & out, Chip8::StopReason reason) const;
+    void showRegisters(std::ostream & out) const;
+    void showMemory(std::ostream & out, uint16_t address, unsigned int length) const;
+    void showDisplay(std::ostream & out) const;
+    void showPoints(std::ostream & out) const;
+
+    static const int DEFAULT_CONTINUE_FRAMES = 3600;    //a minute of machine time
+
+    Chip8 & chip8;
+    Timeline timeline;
+};
+
+
+void Debugger::run(std::istream & in, std::ostream & out) {
+    std::string line;
+    showInstruction(out);
+    out << "> " << std::flush;
+    while(std::getline(in, line) && command(line, out))
+        out << "> " << std::flush;
+}
+
+
+/*
+    parseNumber - reads all of text as a number in base, an empty text gives fallback
+    Return Value : false if text is not a number in base
+*/
+static bool parseNumber(const std::string & text, int base, unsigned long fallback, unsigned long & value) {
+    value = fallback;
+    if(text.empty()) return true;
+    if(!std::isxdigit((unsigned char)text[0])) return false;   //stoul takes signs and spaces
+
+    try {
+        size_t used = 0;
+        value = std::stoul(text, &used, base);
+        return used == text.size();
+    }
+    catch(const std::exception &) {
+        return false;
+    }
+}
+
+
+/*
+    command - runs one command line, the help if its arguments don't parse
+    Return Value : false once asked to quit
+*/
+bool Debugger::command(const std::string & line, std::ostream & out) {
+    std::istringstream fields(line);
+    std::string name, argument, length;
+    fields >> name >> argument >> length;
+
+    unsigned long address = 0, count = 0;
+
+    if(name == "q") return false;
+    else if(name.empty()) return true;
+    else if((name == "b" || name == "bc" || name == "w" || name == "wc") && !argument.empty()
+            && parseNumber(argument, 16, 0, address)) {
+        if(name[0] == 'b') chip8.setBreakpoint((uint16_t)address, name == "b");
+        else chip8.setWatchpoint((uint16_t)address, name == "w");
+        showPoints(out);
+    }
+    else if(name == "l") showPoints(out);
+    else if(name == "s" && parseNumber(argument, 10, 1, count)) {
+        unsigned long steps = count;
+        timeline.resume();
+        for(unsigned long i = 0; i < steps; i++) {
+            chip8.step();
+            timeline.record();
+            if(chip8.stopReason() == Chip8::STOP_WATCHPOINT) break;
+        }
+        showStop(out, chip8.stopReason());
+    }
+    else if(name == "c" && parseNumber(argument, 10, DEFAULT_CONTINUE_FRAMES, count)) {
+        unsigned long frames = count;
+
+        //off the breakpoint we are sitting on first, then whole frames until something stops us
+        timeline.resume();
+        chip8.step();
+        timeline.record();
+        for(unsigned long i = 0; i < frames && chip8.stopReason() == Chip8::STOP_NONE; i++) {
+            chip8.frame();
+            timeline.record();
+        }
+        if(chip8.stopReason() == Chip8::STOP_NONE) out << "no stop in " << std::dec << frames << " frames\n";
+        showStop(out, chip8.stopReason());
+    }
+    else if(name == "rs" && parseNumber(argument, 10, 1, count)) {
+        unsigned long steps = count;
+        for(unsigned long i = 0; i < steps; i++) {
+            if(!timeline.stepBack()) {
+                out << "at the start of history\n";
+                break;
+            }
+        }
+        showStop(out, Chip8::STOP_NONE);
+    }
+    else if(name == "rc") {
+        Chip8::StopReason reason = timeline.continueBack();
+        if(reason == Chip8::STOP_NONE) out << "no earlier stop, at the start of history\n";
+        showStop(out, reason);
+    }
+    else if(name == "r") showRegisters(out);
+    else if(name == "m" && !argument.empty() && parseNumber(argument, 16, 0, address)
+            && parseNumber(length, 10, 64, count)) {
+        showMemory(out, (uint16_t)address, (unsigned int)std::min<unsigned long>(count, MEMORY_BUFF_SIZE));
+    }
+    else if(name == "d") showDisplay(out);
+    else if(name == "k" && !argument.empty()) {                 //"-" lets go of every key
+        uint16_t keys = 0;
+        for(char key : argument)
+            if(std::isxdigit((unsigned char)key)) keys |= 1 << std::stoi(std::string(1, key), nullptr, 16);
+        timeline.setKeys(keys);
+    }
+    else {
+        out << "addresses and keys are hex, n, frames and length decimal\n"
+               "b <addr> / bc <addr>   set / clear a breakpoint\n"
+               "w <addr> / wc <addr>   set / clear a watchpoint\n"
+               "l                      list breakpoints and watchpoints\n"
+               "s [n]                  step n instructions\n"
+               "c [frames]             continue until a stop, " << std::dec << DEFAULT_CONTINUE_FRAMES << " frames at most\n"
+               "rs [n]                 step n instructions backwards\n"
+               "rc                     continue backwards to the previous stop\n"
+               "r                      registers, stack and timers\n"
+               "m <addr> [length]      memory\n"
+               "d                      display\n"
+               "k <keys | ->           hold keys, e.g. k 5a\n"
+               "q                      quit\n";
+    }
+    return true;
+}
+
+
+
+
+void Debugger::showInstruction(std::ostream & out) const {
+    uint16_t PC = chip8.PC & (MEMORY_BUFF_SIZE - 1);
+    uint16_t opcode = (chip8.MEMORY_BUFF[PC] << 8) | chip8.MEMORY_BUFF[(PC + 1) & (MEMORY_BUFF_SIZE - 1)];
+    out << std::hex << std::setfill('0') << "0x" << std::setw(3) << PC << "  " << std::setw(4) << opcode
+        << "  " << ControlFlowGraph::disassemble(opcode) << std::dec << std::setfill(' ') << "\n";
+}
+
+void Debugger::showStop(std::ostream & out, Chip8::StopReason reason) const {
+    if(reason == Chip8::STOP_BREAKPOINT) out << "breakpoint\n";
+    else if(reason == Chip8::STOP_WATCHPOINT)
+        out << "watchpoint 0x" << std::hex << chip8.watchpointHit() << " written by 0x" << (chip8.PC - 2) << std::dec << "\n";
+    showInstruction(out);
+}
+
+void Debugger::showRegisters(std::ostream & out) const {
+    out << std::hex << std::setfill('0');
+    for(int i = 0; i < 16; i++)
+        out << "V" << std::uppercase << i << std::nouppercase << "=" << std::setw(2) << (int)chip8.registers[i] << (i % 8 == 7 ? "\n" : " ");
+    out << "PC=" << std::setw(3) << chip8.PC << " I=" << std::setw(3) << chip8.I << " SP=" << (int)chip8.SP
+        << " DT=" << std::setw(2) << (int)chip8.delay_timer << " ST=" << std::setw(2) << (int)chip8.sound_timer << "\nstack:";
+    for(int i = 0; i < chip8.SP && i < STACK_SIZE; i++)
+        out << " " << std::setw(3) << chip8.RA_Stack[i];
+    out << std::dec << std::setfill(' ') << "\ninstructions: " << chip8.instructionsExecuted() << "\n";
+}
+
+void Debugger::showMemory(std::ostream & out, uint16_t address, unsigned int length) const {
+    out << std::hex << std::setfill('0');
+    for(unsigned int i = 0; i < length; i++) {
+        uint16_t at = (address + i) & (MEMORY_BUFF_SIZE - 1);
+        if(i % 16 == 0) out << (i ? "\n" : "") << std::setw(3) << at << ":";
+        out << " " << std::setw(2) << (int)chip8.MEMORY_BUFF[at];
+    }
+    out << std::dec << std::setfill(' ') << "\n";
+}
+
+void Debugger::showDisplay(std::ostream & out) const {
+    for(int y = 0; y < HEIGHT; y++) {
+        for(int x = 0; x < WIDTH; x++)
+            out << ((chip8.DisplayBuffer[y] >> (WIDTH - 1 - x)) & 1 ? '#' : '.');
+        out << "\n";
+    }
+}
+
+void Debugger::showPoints(std::ostream & out) const {
+    out << std::hex << "breakpoints:";
+    for(unsigned int address = 0; address < MEMORY_BUFF_SIZE; address++)
+        if(chip8.breakpoints[address]) out << " " << address;
+    out << "\nwatchpoints:";
+    for(unsigned int address = 0; address < MEMORY_BUFF_SIZE; address++)
+        if(chip8.watchpoints[address]) out << " " << address;
+    out << std::dec << "\n";
+}
+
+
+
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        std::cout << "Usage: chip8dbg <rom>\n";
+        return 1;
+    }
+
+    Chip8 chip8;
+    if(!chip8.loadROM(argv[1])) return 1;
+
+    Debugger debugger(chip8);
+    debugger.run(std::cin, std::cout);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "Chip8.h"
+#include "control_flow.h"
+#include <cstring>
+
+
+/*
+chip8dis - prints the code and data of a ROM as Chip8::controlFlow() recovers them, block by
+    block, and writes its control flow graph for Graphviz or as JSON.
+
+    Usage: chip8dis <rom> [--dot <file.dot>] [--json <file.json>]
+*/
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        std::cout << "Usage: chip8dis <rom> [--dot <file.dot>] [--json <file.json>]\n";
+        return 1;
+    }
+
+    Chip8 chip8;
+    if(!chip8.loadROM(argv[1])) return 1;
+    const ControlFlowGraph & graph = chip8.controlFlow();
+
+    bool ok = true;
+    for(int i = 2; i + 1 < argc; i += 2) {
+        if(std::strcmp(argv[i], "--dot") == 0) ok = graph.writeDot(argv[i + 1]) && ok;
+        else if(std::strcmp(argv[i], "--json") == 0) ok = graph.writeJSON(argv[i + 1]) && ok;
+        else std::cout << "Unknown option " << argv[i] << "\n";
+    }
+
+    graph.writeListing(std::cout);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#include "Chip8.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+
+/*
+chip8check - runs ROMs through the backend chip8core was built with (CHIP8_DISPATCH) and through
+    step(), the reference interpreter, and compares the two machines' save states after every
+    frame. Build with CHIP8_DISPATCH=JIT to check the JIT.
+
+    Usage: chip8check [random ROMs] [frames] [rom...]
+
+    Random ROMs are 96 bytes of valid instructions, calls and returns included: SP wraps around
+    the stack, so unbalanced ones are fine. Every ROM runs twice: once frame after frame, and
+    once the way run-ahead drives a machine, a few frames run then thrown away through
+    loadState() before every real frame. Keys change every few frames, the clock speed
+    differs from ROM to ROM.
+*/
+static const int DEFAULT_RANDOM_ROMS = 300;
+static const int DEFAULT_FRAMES = 120;
+static const int ROM_SIZE = 96;
+static const int RUN_AHEAD_FRAMES = 2;
+
+static uint16_t randomInstruction(std::mt19937 & random) {
+    uint16_t x = random() % 16, y = random() % 16, kk = random() % 256;
+    uint16_t target = STARTING_ADDR + 2 * (random() % (ROM_SIZE / 2));
+
+    switch(random() % 16) {
+        case 0:  return random() % 8 ? 0x1000 | target : 0x00E0;
+        case 1:  return 0x3000 | x << 8 | kk % 4;
+        case 2:  return 0x4000 | x << 8 | kk % 4;
+        case 3:  return (random() % 2 ? 0x5000 : 0x9000) | x << 8 | y << 4;
+        case 4:  return 0x6000 | x << 8 | kk;
+        case 5:  return 0x7000 | x << 8 | kk;
+        case 6:  {
+            static const uint8_t ops[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+            return 0x8000 | x << 8 | y << 4 | ops[random() % 9];
+        }
+        case 7:  return 0xA000 | (random() % 2 ? target : random() % MEMORY_BUFF_SIZE);
+        case 8:  return 0xB000 | (target - random() % 4);
+        case 9:  return 0xC000 | x << 8 | kk;
+        case 10: return 0xD000 | x << 8 | y << 4 | random() % 16;
+        case 11: return (random() % 2 ? 0xE09E : 0xE0A1) | x << 8;
+        case 12: return random() % 2 ? 0x2000 | target : 0x00EE;
+        case 13: {
+            static const uint8_t ops[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29};
+            return 0xF000 | x << 8 | ops[random() % 6];
+        }
+        default: {
+            static const uint8_t ops[] = {0x33, 0x55, 0x65};
+            return 0xF000 | x << 8 | ops[random() % 3];
+        }
+    }
+}
+
+static bool sameState(const Chip8 & checked, const Chip8 & reference) {
+    Chip8::SaveState a, b;
+    checked.saveState(a);
+    reference.saveState(b);
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+/*
+    check - runs one ROM both ways for frames frames
+    Return Value : false if the machines ever differ, the frame is printed
+*/
+static bool check(const std::string & name, const uint8_t * rom, size_t size, int frames, int instructionsPerFrame, bool runAhead) {
+    Chip8 checked, reference;
+    if(!checked.loadROM(rom, size) || !reference.loadROM(rom, size)) return false;
+    checked.setInstructionsPerFrame(instructionsPerFrame);
+    reference.setInstructionsPerFrame(instructionsPerFrame);
+
+    Chip8::SaveState real;
+    for(int frame = 0; frame < frames; frame++) {
+        uint16_t keys = (frame / 5) % 3 == 0 ? 0 : 1 << ((frame * 7) % 16);
+        for(int key = 0; key < 16; key++)
+            checked.keypad[key] = reference.keypad[key] = (keys >> key) & 1;
+
+        if(runAhead) {
+            checked.saveState(real);
+            for(int ahead = 0; ahead < RUN_AHEAD_FRAMES; ahead++) checked.frame();
+            checked.loadState(real);
+        }
+
+        checked.frame();
+        for(int i = 0; i < instructionsPerFrame; i++) reference.step();
+
+        if(!sameState(checked, reference)) {
+            std::cout << name << ": differs after frame " << frame << " at " << instructionsPerFrame
+                      << " instructions per frame" << (runAhead ? " with run-ahead" : "") << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkBothWays(const std::string & name, const uint8_t * rom, size_t size, int frames, int instructionsPerFrame) {
+    bool plain = check(name, rom, size, frames, instructionsPerFrame, false);
+    return check(name, rom, size, frames, instructionsPerFrame, true) && plain;
+}
+
+
+int main(int argc, char *argv[]) {
+    int randomROMs = argc > 1 ? std::atoi(argv[1]) : DEFAULT_RANDOM_ROMS;
+    int frames = argc > 2 ? std::atoi(argv[2]) : DEFAULT_FRAMES;
+    int failed = 0, checked = 0;
+
+    std::mt19937 random(1);
+    for(int i = 0; i < randomROMs; i++) {
+        uint8_t rom[ROM_SIZE];
+        for(int at = 0; at < ROM_SIZE; at += 2) {
+            uint16_t opcode = randomInstruction(random);
+            rom[at] = opcode >> 8;
+            rom[at + 1] = opcode & 0xFF;
+        }
+        int instructionsPerFrame = 1 + random() % 400;
+        failed += !checkBothWays("random ROM " + std::to_string(i), rom, ROM_SIZE, frames, instructionsPerFrame);
+        checked++;
+    }
+
+    for(int i = 3; i < argc; i++) {
+        std::ifstream file(argv[i], std::ios::binary);
+        std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if(rom.empty()) {
+            std::cout << "Error: " << argv[i] << " does not exist!\n";
+            failed++;
+            continue;
+        }
+        bool same = true;
+        for(int instructionsPerFrame : {7, 100, 1000})
+            same = checkBothWays(argv[i], rom.data(), rom.size(), frames, instructionsPerFrame) && same;
+        failed += !same;
+        checked++;
+    }
+
+    std::cout << checked << " ROMs checked, " << failed << " differ\n";
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,534 @@
+#include "jit_compiler.h"
+
+#if CHIP8_JIT
+
+#include <cstring>
+#include <stdexcept>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+
+//x86 byte register numbers used in ModRM reg fields
+static const uint8_t AL = 0;
+static const uint8_t CL = 1;
+static const uint8_t DL = 2;
+
+//condition codes for jcc
+static const uint8_t CC_B  = 0x2;
+static const uint8_t CC_E  = 0x4;
+static const uint8_t CC_NE = 0x5;
+
+
+
+/*
+    JitCompiler - only works out where the machine state lives, the code buffer is mapped by the
+    first run() so machines that never get there don't hold one
+*/
+JitCompiler::JitCompiler(Chip8 & chip8) : chip8(chip8) {
+    //offsets of the machine state from the Chip8 object
+    const uint8_t * base = (const uint8_t *)&chip8;
+    registersOffset = (int32_t)((const uint8_t *)chip8.registers - base);
+    PCOffset        = (int32_t)((const uint8_t *)&chip8.PC - base);
+    IOffset         = (int32_t)((const uint8_t *)&chip8.I - base);
+    SPOffset        = (int32_t)((const uint8_t *)&chip8.SP - base);
+    stackOffset     = (int32_t)((const uint8_t *)chip8.RA_Stack - base);
+    delayOffset     = (int32_t)((const uint8_t *)&chip8.delay_timer - base);
+    soundOffset     = (int32_t)((const uint8_t *)&chip8.sound_timer - base);
+    instOffset      = (int32_t)((const uint8_t *)&chip8.inst - base);
+
+    flush();
+}
+
+JitCompiler::~JitCompiler() {
+    if(code == nullptr) return;
+#ifdef _WIN32
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, CODE_BUFFER_SIZE);
+#endif
+}
+
+
+/*
+    allocate - maps the code buffer read/write and emits the trampoline every block is entered
+    through and the epilogue every block leaves through
+*/
+void JitCompiler::allocate() {
+#ifdef _WIN32
+    code = (uint8_t *)VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void * buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    code = buffer == MAP_FAILED ? nullptr : (uint8_t *)buffer;
+#endif
+
+    if(code == nullptr)
+        throw std::runtime_error("ERROR: JIT could not allocate executable memory");
+    writable = true;
+
+
+    //trampoline - uint64_t enter(Chip8 * chip8, uint64_t budget, const uint8_t * block)
+    //rbx = chip8, r12 = remaining budget, stack left 16 byte aligned with shadow space for calls
+    emitPtr = code;
+    enter = (EntryFunction)emitPtr;
+    emit8(0x53);                                            //push rbx
+    emit8(0x41); emit8(0x54);                               //push r12
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x28);     //sub rsp, 40
+#ifdef _WIN32
+    emit8(0x48); emit8(0x89); emit8(0xCB);                  //mov rbx, rcx
+    emit8(0x49); emit8(0x89); emit8(0xD4);                  //mov r12, rdx
+    emit8(0x41); emit8(0xFF); emit8(0xE0);                  //jmp r8
+#else
+    emit8(0x48); emit8(0x89); emit8(0xFB);                  //mov rbx, rdi
+    emit8(0x49); emit8(0x89); emit8(0xF4);                  //mov r12, rsi
+    emit8(0xFF); emit8(0xE2);                               //jmp rdx
+#endif
+
+    //epilogue - returns the budget that is left
+    epilogue = emitPtr;
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x28);     //add rsp, 40
+    emit8(0x4C); emit8(0x89); emit8(0xE0);                  //mov rax, r12
+    emit8(0x41); emit8(0x5C);                               //pop r12
+    emit8(0x5B);                                            //pop rbx
+    emit8(0xC3);                                            //ret
+
+    blocksStart = emitPtr;
+    flush();
+}
+
+
+/*
+    protect - flips the code buffer between writable and executable, it is never both. Only
+    compiling and linking write to it, so a warmed up ROM runs without flipping at all
+*/
+void JitCompiler::protect(bool write) {
+    if(write == writable) return;
+
+#ifdef _WIN32
+    DWORD previous;
+    bool changed = VirtualProtect(code, CODE_BUFFER_SIZE, write ? PAGE_READWRITE : PAGE_EXECUTE_READ, &previous) != 0;
+#else
+    bool changed = mprotect(code, CODE_BUFFER_SIZE, write ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+
+    if(!changed)
+        throw std::runtime_error("ERROR: JIT could not change the protection of its code");
+    writable = write;
+}
+
+
+/*
+    flush - forgets every compiled block. Safe to call from a handler the JIT code called into,
+    the bytes of the running block stay untouched until the next compile
+*/
+void JitCompiler::flush() {
+    emitPtr = blocksStart;
+    for(unsigned int i = 0; i < MEMORY_BUFF_SIZE / 2; i++)
+        entries[i] = nullptr;
+
+    lastExit = nullptr;
+    pendingLinks.clear();
+    generation++;
+}
+
+
+/*
+    run - executes up to budget instructions through compiled blocks
+    Return Value : number of instructions executed
+    Description:
+        The code buffer is only written at the top, so it flips to writable and back at most
+        once per call. Blocks first reached during a call are interpreted for the rest of it and
+        compiled by the next one, exits taken before they were linked are linked then too.
+*/
+unsigned long JitCompiler::run(unsigned long budget) {
+    unsigned long executed = 0;
+    if(code == nullptr) allocate();
+    if(!pendingBlocks.empty() || !pendingLinks.empty()) compilePending();
+    protect(false);
+
+    while(executed < budget) {
+        //jumps into idle loops always come back here, see compile()
+        executed += chip8.skipIdle(budget - executed);
+        if(executed == budget) break;
+
+        uint16_t PC = chip8.PC;
+
+        //odd or out of range PC can't start a block, leave it to the interpreter
+        if((PC & ~(MEMORY_BUFF_SIZE - 2)) != 0) {
+            chip8.cycle();
+            executed++;
+            continue;
+        }
+
+        const uint8_t * block = entries[PC >> 1];
+        if(block == nullptr) {
+            if(!pending[PC >> 1]) {
+                pending[PC >> 1] = true;
+                pendingBlocks.push_back(PC);
+            }
+
+            //up to and including the instruction the block would end with
+            do {
+                chip8.cycle();
+                executed++;
+            } while(executed < budget && !Chip8::endsBlock(chip8.inst->index));
+            continue;
+        }
+
+        unsigned int before = generation;
+        unsigned long remaining = budget - executed;
+        unsigned long ran = remaining - enter(&chip8, remaining, block);
+        executed += ran;
+
+        //an exit the block left through unlinked, unless a handler flushed the block meanwhile
+        if(lastExit != nullptr && generation == before) {
+            bool known = false;
+            for(const Link & link : pendingLinks)
+                known = known || link.rel32 == lastExit;
+            if(!known) pendingLinks.push_back(Link{lastExit, lastExitTarget});
+        }
+        lastExit = nullptr;
+
+        //the block at PC is longer than the budget left, finish it one instruction at a time
+        if(ran == 0) {
+            chip8.cycle();
+            executed++;
+        }
+    }
+
+    return executed;
+}
+
+
+/*
+    compilePending - compiles the blocks the last run() interpreted and links the exits it took
+    to blocks that didn't exist yet. Anything compile() flushes on the way is dropped with the
+    rest of the buffer
+*/
+void JitCompiler::compilePending() {
+    protect(true);
+
+    std::vector<uint16_t> blocks;
+    std::vector<Link> links;
+    blocks.swap(pendingBlocks);
+    links.swap(pendingLinks);
+    pending.reset();
+
+    for(uint16_t address : blocks)
+        if(entries[address >> 1] == nullptr) compile(address);
+
+    unsigned int before = generation;
+    for(const Link & link : links) {
+        if((link.target & ~(MEMORY_BUFF_SIZE - 2)) != 0) continue;
+
+        const uint8_t * block = entries[link.target >> 1];
+        if(block == nullptr) block = compile(link.target);
+        if(generation != before) break;
+        patchJump(link.rel32, block);
+    }
+}
+
+
+/*
+    compile - translates the basic block starting at address
+    Return Value : entry point of the compiled block
+*/
+const uint8_t * JitCompiler::compile(uint16_t address) {
+    if((size_t)(code + CODE_BUFFER_SIZE - emitPtr) < MAX_BLOCK_CODE) flush();
+
+    uint16_t length = chip8.translateBlock(address);
+    const uint8_t * entry = emitPtr;
+    entries[address >> 1] = entry;      //registered first so a block can jump to itself
+
+    //prologue - bail out before touching anything if the block doesn't fit in the budget
+    emit8(0x49); emit8(0x81); emit8(0xFC); emit32(length);  //cmp r12, length
+    patchJump(emitJcc(CC_B), epilogue);                      //jb epilogue
+    emit8(0x49); emit8(0x81); emit8(0xEC); emit32(length);  //sub r12, length
+
+    bool exited = false;
+
+    for(uint16_t i = 0; i < length; i++) {
+        uint16_t pc = address + 2 * i;
+        const Chip8::Instruction & op = chip8.decodeCache[pc >> 1];
+        int32_t Vx = registersOffset + op.x;
+        int32_t Vy = registersOffset + op.y;
+        int32_t VF = registersOffset + 0xF;
+
+        switch(op.index) {
+            case Chip8::OP_0nnn:
+            case Chip8::OP_1nnn:
+                if(op.index == Chip8::OP_1nnn && chip8.idleLoopAt(op.nnn) != Chip8::IDLE_NONE) {
+                    //never chained, run() fast forwards through the loop instead
+                    emitMem(0x66, 0xC7, 0, PCOffset); emit16(op.nnn);  //mov word [PC], nnn
+                    emitDynamicExit();
+                }
+                else
+                    emitStaticExit(op.nnn);
+                exited = true;
+                break;
+
+            case Chip8::OP_2nnn:
+                emitMem(0x0F, 0xB6, AL, SPOffset);                          //movzx eax, [SP]
+                emit8(0x66); emit8(0xC7); emit8(0x84); emit8(0x43);         //mov word [rbx+rax*2+stack], pc+2
+                emit32(stackOffset); emit16(pc + 2);
+                emitMem(0xFE, 0, SPOffset);                                 //inc byte [SP]
+                emitMem(0x80, 4, SPOffset); emit8(STACK_SIZE - 1);          //and byte [SP], 15
+                emitStaticExit(op.nnn);
+                exited = true;
+                break;
+
+            case Chip8::OP_3xkk:
+            case Chip8::OP_4xkk:
+            case Chip8::OP_5xy0:
+            case Chip8::OP_9xy0: {
+                if(op.index == Chip8::OP_3xkk || op.index == Chip8::OP_4xkk) {
+                    emitMem(0x80, 7, Vx); emit8(op.kk);                     //cmp byte [Vx], kk
+                }
+                else {
+                    emitMem(0x8A, AL, Vx);                                  //mov al, [Vx]
+                    emitMem(0x3A, AL, Vy);                                  //cmp al, [Vy]
+                }
+
+                bool skipIfEqual = op.index == Chip8::OP_3xkk || op.index == Chip8::OP_5xy0;
+                uint8_t * noSkip = emitJcc(skipIfEqual ? CC_NE : CC_E);
+                emitStaticExit(pc + 4);
+                patchJump(noSkip, emitPtr);
+                emitStaticExit(pc + 2);
+                exited = true;
+                break;
+            }
+
+            case Chip8::OP_6xkk:
+                emitMem(0xC6, 0, Vx); emit8(op.kk);                         //mov byte [Vx], kk
+                break;
+
+            case Chip8::OP_7xkk:
+                emitMem(0x80, 0, Vx); emit8(op.kk);                         //add byte [Vx], kk
+                break;
+
+            case Chip8::OP_8xy0:
+                emitMem(0x8A, AL, Vy);                                      //mov al, [Vy]
+                emitMem(0x88, AL, Vx);                                      //mov [Vx], al
+                break;
+
+            case Chip8::OP_8xy1:
+            case Chip8::OP_8xy2:
+            case Chip8::OP_8xy3:
+                emitMem(0x8A, AL, Vy);                                      //mov al, [Vy]
+                emitMem(op.index == Chip8::OP_8xy1 ? 0x08 :                 //or/and/xor [Vx], al
+                        op.index == Chip8::OP_8xy2 ? 0x20 : 0x30, AL, Vx);
+                break;
+
+            case Chip8::OP_8xy4:
+                emitMem(0x8A, AL, Vy);                                      //mov al, [Vy]
+                emitMem(0x00, AL, Vx);                                      //add [Vx], al
+                emit8(0x0F); emit8(0x92); emit8(0xC0);                      //setc al
+                emitMem(0x88, AL, VF);                                      //mov [VF], al
+                break;
+
+            case Chip8::OP_8xy5:
+                emitMem(0x8A, AL, Vx);                                      //mov al, [Vx]
+                emitMem(0x8A, CL, Vy);                                      //mov cl, [Vy]
+                emit8(0x38); emit8(0xC8);                                   //cmp al, cl
+                emit8(0x0F); emit8(0x97); emit8(0xC2);                      //seta dl
+                emitMem(0x88, DL, VF);                                      //mov [VF], dl
+                emit8(0x28); emit8(0xC8);                                   //sub al, cl
+                emitMem(0x88, AL, Vx);                                      //mov [Vx], al
+                break;
+
+            case Chip8::OP_8xy6:
+                emitMem(0x8A, AL, Vx);                                      //mov al, [Vx]
+                emit8(0x88); emit8(0xC2);                                   //mov dl, al
+                emit8(0x80); emit8(0xE2); emit8(0x01);                      //and dl, 1
+                emitMem(0x88, DL, VF);                                      //mov [VF], dl
+                emit8(0xD0); emit8(0xE8);                                   //shr al, 1
+                emitMem(0x88, AL, Vx);                                      //mov [Vx], al
+                break;
+
+            case Chip8::OP_8xy7:
+                emitMem(0x8A, AL, Vx);                                      //mov al, [Vx]
+                emitMem(0x8A, CL, Vy);                                      //mov cl, [Vy]
+                emit8(0x38); emit8(0xC1);                                   //cmp cl, al
+                emit8(0x0F); emit8(0x97); emit8(0xC2);                      //seta dl
+                emitMem(0x88, DL, VF);                                      //mov [VF], dl
+                emit8(0x28); emit8(0xC1);                                   //sub cl, al
+                emitMem(0x88, CL, Vx);                                      //mov [Vx], cl
+                break;
+
+            case Chip8::OP_8xyE:
+                emitMem(0x8A, AL, Vx);                                      //mov al, [Vx]
+                emit8(0x88); emit8(0xC2);                                   //mov dl, al
+                emit8(0xC0); emit8(0xEA); emit8(0x07);                      //shr dl, 7
+                emitMem(0x88, DL, VF);                                      //mov [VF], dl
+                emit8(0x00); emit8(0xC0);                                   //add al, al
+                emitMem(0x88, AL, Vx);                                      //mov [Vx], al
+                break;
+
+            case Chip8::OP_Annn:
+                emitMem(0x66, 0xC7, 0, IOffset); emit16(op.nnn);            //mov word [I], nnn
+                break;
+
+            case Chip8::OP_Bnnn:
+                emitMem(0x0F, 0xB6, AL, registersOffset);                   //movzx eax, [V0]
+                emit8(0x05); emit32(op.nnn);                                //add eax, nnn
+                emitMem(0x66, 0x89, AL, PCOffset);                          //mov [PC], ax
+                emitDynamicExit();
+                exited = true;
+                break;
+
+            case Chip8::OP_Fx07:
+                emitMem(0x8A, AL, delayOffset);                             //mov al, [DT]
+                emitMem(0x88, AL, Vx);                                      //mov [Vx], al
+                break;
+
+            case Chip8::OP_Fx15:
+            case Chip8::OP_Fx18:
+                emitMem(0x8A, AL, Vx);                                      //mov al, [Vx]
+                emitMem(0x88, AL, op.index == Chip8::OP_Fx15 ? delayOffset : soundOffset);
+                break;
+
+            case Chip8::OP_Fx1E:
+                emitMem(0x0F, 0xB6, AL, Vx);                                //movzx eax, [Vx]
+                emitMem(0x66, 0x01, AL, IOffset);                           //add [I], ax
+                break;
+
+            case Chip8::OP_Fx29:
+                emitMem(0x0F, 0xB6, AL, Vx);                                //movzx eax, [Vx]
+                emit8(0x8D); emit8(0x84); emit8(0x80);                      //lea eax, [rax+rax*4+FONT]
+                emit32(FONT_STARTING_ADDRESS);
+                emitMem(0x66, 0x89, AL, IOffset);                           //mov [I], ax
+                break;
+
+            //display, random numbers and register loads go through the interpreter handler
+            case Chip8::OP_00E0:
+            case Chip8::OP_Cxkk:
+            case Chip8::OP_Dxyn:
+            case Chip8::OP_Fx65:
+                emitHandlerCall(pc);
+                break;
+
+            //the rest change PC in ways only known at run time, or write memory and may have
+            //flushed this very block, so they always return to run()
+            default:
+                emitHandlerCall(pc);
+                emitDynamicExit();
+                exited = true;
+                break;
+        }
+    }
+
+    //block was cut at MAX_BLOCK_LENGTH or the end of memory, fall through to the next one
+    if(!exited) {
+        emitStaticExit(address + 2 * length);
+    }
+
+    return entry;
+}
+
+
+//Emitters
+void JitCompiler::emit8(uint8_t value) {
+    *emitPtr++ = value;
+}
+
+void JitCompiler::emit16(uint16_t value) {
+    memcpy(emitPtr, &value, sizeof(value));
+    emitPtr += sizeof(value);
+}
+
+void JitCompiler::emit32(uint32_t value) {
+    memcpy(emitPtr, &value, sizeof(value));
+    emitPtr += sizeof(value);
+}
+
+void JitCompiler::emit64(uint64_t value) {
+    memcpy(emitPtr, &value, sizeof(value));
+    emitPtr += sizeof(value);
+}
+
+/*
+    emitMem - opcode with a [rbx + offset] memory operand, reg goes in the ModRM reg field
+*/
+void JitCompiler::emitMem(uint8_t opcode, uint8_t reg, int32_t offset) {
+    emit8(opcode);
+    emit8(0x80 | (reg << 3) | 0x3);     //mod = disp32, rm = rbx
+    emit32((uint32_t)offset);
+}
+
+void JitCompiler::emitMem(uint8_t prefix, uint8_t opcode, uint8_t reg, int32_t offset) {
+    emit8(prefix);
+    emitMem(opcode, reg, offset);
+}
+
+/*
+    emitJump / emitJcc - jumps with a rel32 to be filled in by patchJump
+    Return Value : address of the rel32
+*/
+uint8_t * JitCompiler::emitJump(uint8_t opcode) {
+    emit8(opcode);
+    uint8_t * rel32 = emitPtr;
+    emit32(0);
+    return rel32;
+}
+
+uint8_t * JitCompiler::emitJcc(uint8_t condition) {
+    emit8(0x0F);
+    return emitJump(0x80 | condition);
+}
+
+void JitCompiler::patchJump(uint8_t * rel32, const uint8_t * target) {
+    int32_t displacement = (int32_t)(target - (rel32 + 4));
+    memcpy(rel32, &displacement, sizeof(displacement));
+}
+
+/*
+    emitHandlerCall - calls the interpreter's handler for the instruction at address with PC
+    and inst set up exactly like the interpreter would
+*/
+void JitCompiler::emitHandlerCall(uint16_t address) {
+    const Chip8::Instruction * slot = &chip8.decodeCache[address >> 1];
+
+    emitMem(0x66, 0xC7, 0, PCOffset); emit16(address + 2);     //mov word [PC], address+2
+    emit8(0x48); emit8(0xB8); emit64((uint64_t)slot);           //mov rax, slot
+    emitMem(0x48, 0x89, AL, instOffset);                        //mov [inst], rax
+#ifdef _WIN32
+    emit8(0x48); emit8(0x89); emit8(0xD9);                      //mov rcx, rbx
+#else
+    emit8(0x48); emit8(0x89); emit8(0xDF);                      //mov rdi, rbx
+#endif
+    emit8(0x48); emit8(0xB8);                                   //mov rax, handler
+    emit64((uint64_t)Chip8::opHandlers[slot->index]);
+    emit8(0xFF); emit8(0xD0);                                   //call rax
+}
+
+/*
+    emitStaticExit - sets PC to a known target and jumps to its block. Until that block is
+    compiled the jump lands on a stub that records itself and target in lastExit and
+    lastExitTarget so run() can link it
+*/
+void JitCompiler::emitStaticExit(uint16_t target) {
+    emitMem(0x66, 0xC7, 0, PCOffset); emit16(target);          //mov word [PC], target
+
+    const uint8_t * linked = (target & ~(MEMORY_BUFF_SIZE - 2)) == 0 ? entries[target >> 1] : nullptr;
+    uint8_t * rel32 = emitJump(0xE9);                           //jmp block
+    if(linked != nullptr) {
+        patchJump(rel32, linked);
+        return;
+    }
+    patchJump(rel32, emitPtr);
+
+    emit8(0x48); emit8(0xB8); emit64((uint64_t)&lastExit);      //mov rax, &lastExit
+    emit8(0x48); emit8(0xB9); emit64((uint64_t)rel32);          //mov rcx, rel32
+    emit8(0x48); emit8(0x89); emit8(0x08);                      //mov [rax], rcx
+    emit8(0x48); emit8(0xB8); emit64((uint64_t)&lastExitTarget); //mov rax, &lastExitTarget
+    emit8(0x66); emit8(0xC7); emit8(0x00); emit16(target);      //mov word [rax], target
+    patchJump(emitJump(0xE9), epilogue);                        //jmp epilogue
+}
+
+void JitCompiler::emitDynamicExit() {
+    patchJump(emitJump(0xE9), epilogue);                        //jmp epilogue
+}
+
+#endif
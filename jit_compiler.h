@@ -0,0 +1,105 @@
+#ifndef SDLTEST_JIT_COMPILER_H
+#define SDLTEST_JIT_COMPILER_H
+
+#include <bitset>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Chip8.h"
+
+
+//the JIT only exists on x86-64 hosts, anywhere else CHIP8_JIT_DISPATCH falls back to the
+//threaded interpreter
+#if defined(CHIP8_JIT_DISPATCH) && (defined(__x86_64__) || defined(_M_X64))
+#define CHIP8_JIT 1
+#else
+#define CHIP8_JIT 0
+#endif
+
+
+/*
+JitCompiler - translates Chip8 basic blocks into x86-64 machine code.
+
+    Each block is compiled once into a code buffer and entered through a small trampoline that
+    keeps the Chip8 object in rbx and the remaining instruction budget in r12. Blocks end at the
+    same instructions Chip8::endsBlock reports. Exits to a known address are patched into direct
+    jumps to the next block once they have been taken, so a hot loop never comes back to run()
+    until the budget is spent.
+
+    Simple ALU, load and branch instructions are emitted inline, anything touching the display,
+    keypad, stack return, random numbers or memory writes calls the interpreter's handler for
+    that instruction. Writing into translated code flushes the whole buffer through
+    Chip8::flushBlocks.
+
+    The buffer is mapped on the first run() and is either writable or executable, never both.
+    Compiling and linking are batched at the start of run() so it flips at most twice per call,
+    a block first reached mid-call is interpreted until the next one.
+*/
+class JitCompiler {
+public:
+    explicit JitCompiler(Chip8 & chip8);
+    ~JitCompiler();
+
+    unsigned long run(unsigned long budget);
+    void flush();
+
+private:
+    typedef uint64_t (*EntryFunction)(Chip8 * chip8, uint64_t budget, const uint8_t * block);
+
+    static const size_t CODE_BUFFER_SIZE = 1 << 20;
+    static const size_t MAX_BLOCK_CODE = 16 * 1024;    //worst case code for one block
+
+    void allocate();
+    void protect(bool write);
+    void compilePending();
+    const uint8_t * compile(uint16_t address);
+
+    //emitters
+    void emit8(uint8_t value);
+    void emit16(uint16_t value);
+    void emit32(uint32_t value);
+    void emit64(uint64_t value);
+    void emitMem(uint8_t opcode, uint8_t reg, int32_t offset);
+    void emitMem(uint8_t prefix, uint8_t opcode, uint8_t reg, int32_t offset);
+    uint8_t * emitJump(uint8_t opcode);
+    uint8_t * emitJcc(uint8_t condition);
+    void patchJump(uint8_t * rel32, const uint8_t * target);
+    void emitHandlerCall(uint16_t address);
+    void emitStaticExit(uint16_t target);
+    void emitDynamicExit();
+
+    Chip8 & chip8;
+
+    uint8_t * code = nullptr;                       //mapped by the first run()
+    bool writable = false;                          //else executable
+    uint8_t * emitPtr = nullptr;                    //next free byte
+    uint8_t * blocksStart = nullptr;                //first byte after the trampoline/epilogue
+    uint8_t * epilogue = nullptr;
+    EntryFunction enter = nullptr;
+
+    const uint8_t * entries[MEMORY_BUFF_SIZE / 2];  //compiled block per even start address
+    uint8_t * lastExit = nullptr;                   //unlinked exit the last block entered left by
+    uint16_t lastExitTarget = 0;                    //the guest address it leads to
+    unsigned int generation = 0;                    //bumped on every flush
+
+    //work left for the next run(), see compilePending()
+    struct Link {
+        uint8_t * rel32;
+        uint16_t target;
+    };
+    std::vector<uint16_t> pendingBlocks;
+    std::bitset<MEMORY_BUFF_SIZE / 2> pending;      //by start address, what pendingBlocks holds
+    std::vector<Link> pendingLinks;
+
+    //offsets of the machine state from the Chip8 object held in rbx
+    int32_t registersOffset;
+    int32_t PCOffset;
+    int32_t IOffset;
+    int32_t SPOffset;
+    int32_t stackOffset;
+    int32_t delayOffset;
+    int32_t soundOffset;
+    int32_t instOffset;
+};
+
+#endif //SDLTEST_JIT_COMPILER_H
@@ -0,0 +1,99 @@
+#include "Chip8.h"
+#include "lockstep_engine.h"
+#include "work_stealing_pool.h"
+#include <algorithm>
+
+
+/*
+lockstep_benchmark - runs the same lanes of one ROM as separate Chip8 machines and through
+    LockstepEngine, and prints the throughput of each.
+
+    Lane i holds a different key every 13 frames so the lanes get a chance to diverge. Each
+    thread gets its own share of the lanes, as its own machines or its own engine.
+
+    Usage: lockstep_benchmark <rom> [lanes] [frames] [threads]
+*/
+static const int KEY_FRAMES = 13;
+
+static uint16_t heldKeys(size_t lane, int frame) {
+    int held = (lane * 7 + frame / KEY_FRAMES) % 20;    //16 and up hold nothing
+    return held < 16 ? 1 << held : 0;
+}
+
+static double runMachines(const char * rom, size_t first, size_t count, int frames) {
+    std::vector<std::unique_ptr<Chip8>> machines;
+    for(size_t lane = 0; lane < count; lane++) {
+        machines.emplace_back(new Chip8());
+        if(!machines.back()->loadROM(rom)) return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < frames; frame++) {
+        for(size_t lane = 0; lane < count; lane++) {
+            if(frame % KEY_FRAMES == 0) {
+                uint16_t keys = heldKeys(first + lane, frame);
+                for(int key = 0; key < 16; key++)
+                    machines[lane]->keypad[key] = (keys >> key) & 1;
+            }
+            machines[lane]->frame();
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static double runEngine(const char * rom, size_t first, size_t count, int frames, uint64_t & vectorInstructions) {
+    LockstepEngine engine(count);
+    if(!engine.loadROM(rom)) return 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < frames; frame++) {
+        for(size_t lane = 0; frame % KEY_FRAMES == 0 && lane < count; lane++)
+            engine.setKeys(lane, heldKeys(first + lane, frame));
+        engine.frame();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    vectorInstructions = engine.vectorInstructions();
+    return elapsed.count();
+}
+
+
+int main(int argc, char *argv[]) {
+    size_t lanes = argc > 2 ? std::atoi(argv[2]) : 1024;
+    int frames = argc > 3 ? std::atoi(argv[3]) : 600;
+    int threads = argc > 4 ? std::atoi(argv[4]) : 1;
+    if(argc < 2 || lanes == 0 || frames <= 0 || threads <= 0) {
+        std::cout << "Usage: lockstep_benchmark <rom> [lanes] [frames] [threads]\n";
+        return 1;
+    }
+
+    WorkStealingPool pool(threads);
+    double instructions = (double)lanes * frames * DEFAULT_INSTRUCTIONS_PER_FRAME;
+    std::vector<double> seconds(threads);
+    std::vector<uint64_t> vectorInstructions(threads);
+
+    for(int pass = 0; pass < 2; pass++) {
+        //only the frames are timed, setting up thousands of machines takes a while on its own
+        pool.run(threads, [&](size_t thread) {
+            size_t first = lanes * thread / threads, count = lanes * (thread + 1) / threads - first;
+            if(pass == 0) seconds[thread] = runMachines(argv[1], first, count, frames);
+            else seconds[thread] = runEngine(argv[1], first, count, frames, vectorInstructions[thread]);
+        });
+
+        double slowest = 0;
+        for(double thread : seconds) slowest = std::max(slowest, thread);
+        if(slowest == 0) return 1;
+
+        std::cout << (pass == 0 ? "separate machines: " : "lockstep engine:   ")
+                  << instructions / slowest / 1e6 << " MIPS";
+        if(pass == 1) {
+            uint64_t vectorized = 0;
+            for(uint64_t count : vectorInstructions) vectorized += count;
+            std::cout << ", " << 100.0 * vectorized / instructions << "% of instructions vectorized";
+        }
+        std::cout << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include "lockstep_engine.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+//the Block vectors again, for the helpers below
+namespace {
+    typedef uint8_t ByteLanes __attribute__((vector_size(LockstepEngine::BLOCK_LANES)));
+    typedef int8_t ByteMask __attribute__((vector_size(LockstepEngine::BLOCK_LANES)));
+    typedef uint16_t WordLanes __attribute__((vector_size(2 * LockstepEngine::BLOCK_LANES)));
+    typedef int16_t WordMask __attribute__((vector_size(2 * LockstepEngine::BLOCK_LANES)));
+
+    /*
+        blend - copies value into the lanes of target where the mask is set, the other lanes
+        keep what they had. Everything by reference, GCC warns that vectors passed by value
+        change the ABI between SSE and AVX builds
+    */
+    inline void blend(ByteLanes & target, const ByteMask & mask, const ByteLanes & value) {
+        target = (value & (ByteLanes)mask) | (target & ~(ByteLanes)mask);
+    }
+
+    inline void blend(WordLanes & target, const WordMask & mask, const WordLanes & value) {
+        target = (value & (WordLanes)mask) | (target & ~(WordLanes)mask);
+    }
+
+    /*
+        laneBits - one bit per lane of a comparison result, lane 0 in bit 0
+    */
+    inline uint32_t laneBits(const ByteMask & mask) {
+#if defined(__AVX2__)
+        return _mm_movemask_epi8((__m128i)mask);
+#elif defined(__SSE2__)
+        return _mm_movemask_epi8(_mm_loadl_epi64((const __m128i *)&mask)) & 0xFF;
+#else
+        uint32_t bits = 0;
+        for(unsigned int lane = 0; lane < LockstepEngine::BLOCK_LANES; lane++)
+            if(mask[lane]) bits |= 1u << lane;
+        return bits;
+#endif
+    }
+}
+
+
+LockstepEngine::LockstepEngine(size_t lanes) : lanes(lanes) {
+    for(size_t i = 0; i < lanes; i++)
+        machines.emplace_back(new Chip8());
+
+    blocks.resize((lanes + BLOCK_LANES - 1) / BLOCK_LANES);
+    reset();
+}
+
+
+/*
+    loadROM - loads the ROM into every lane and points every PC at its first instruction
+    Return Value : false if the ROM could not be loaded
+*/
+bool LockstepEngine::loadROM(const std::string & filename) {
+    if(lanes == 0) return false;
+
+    //read the file once, every lane gets the same bytes
+    std::ifstream ROM(filename, std::ifstream::in | std::ifstream::binary);
+    if(!ROM.is_open()) {
+        std::cout << "Error: File Does not exist!\n";
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(ROM)), std::istreambuf_iterator<char>());
+    return loadROM(data.data(), data.size());
+}
+
+bool LockstepEngine::loadROM(const uint8_t * data, size_t size) {
+    for(auto & chip8 : machines) {
+        if(!chip8->loadROM(data, size)) return false;
+        chip8->PC = STARTING_ADDR;
+    }
+
+    reset();
+    return true;
+}
+
+
+void LockstepEngine::setInstructionsPerFrame(int instructionsPerFrame) {
+    this->instructionsPerFrame = instructionsPerFrame > 0 ? instructionsPerFrame : 1;
+}
+
+
+/*
+    frame - runs every Block a frame at a time, a Block's state stays in cache for the whole frame
+*/
+void LockstepEngine::frame() {
+    for(size_t b = 0; b < blocks.size(); b++) {
+        Block & block = blocks[b];
+
+        for(int i = 0; i < instructionsPerFrame; i++)
+            stepBlock(block, b * BLOCK_LANES);
+
+        //timers count down towards 0, a true comparison is -1 so adding it decrements
+        block.delayTimer += (ByteLanes)(block.delayTimer != 0);
+        block.soundTimer += (ByteLanes)(block.soundTimer != 0);
+    }
+}
+
+
+void LockstepEngine::setKeys(size_t lane, uint16_t keys) {
+    blocks[lane / BLOCK_LANES].keys[lane % BLOCK_LANES] = keys;
+
+    //for the lanes that still go through the handlers
+    for(int key = 0; key < 16; key++)
+        machines[lane]->keypad[key] = (keys >> key) & 1;
+}
+
+const Chip8 & LockstepEngine::machine(size_t lane) {
+    storeLane(blocks[lane / BLOCK_LANES], lane % BLOCK_LANES, *machines[lane]);
+    return *machines[lane];
+}
+
+
+
+
+/*
+    stepBlock - runs one instruction on every lane of the Block. Lanes are taken a PC at a time,
+    so lanes that have not diverged all go in the first group
+*/
+void LockstepEngine::stepBlock(Block & block, size_t base) {
+    ByteMask pending = (ByteMask)block.live;
+    uint32_t pendingBits;
+
+    while((pendingBits = laneBits(pending)) != 0) {
+        unsigned int leader = __builtin_ctz(pendingBits);
+        uint16_t pc = block.PC[leader];
+        ByteMask group = __builtin_convertvector(block.PC == pc, ByteMask) & pending;
+
+        //fetched the same way Chip8::fetch does, odd and out of range PCs included
+        uint16_t high = pc & (MEMORY_BUFF_SIZE - 1), low = (pc + 1) & (MEMORY_BUFF_SIZE - 1);
+        uint16_t opcode = (image[high] << 8) | image[low];
+
+        //written code may differ between lanes, only lanes holding the leader's opcode come along
+        if(block.written[high] || block.written[low]) {
+            const uint8_t * memory = machines[base + leader]->MEMORY_BUFF;
+            opcode = (memory[high] << 8) | memory[low];
+
+            for(uint32_t rest = laneBits(group) & ~(1u << leader); rest != 0; rest &= rest - 1) {
+                unsigned int lane = __builtin_ctz(rest);
+                const uint8_t * laneMemory = machines[base + lane]->MEMORY_BUFF;
+                if(((laneMemory[high] << 8) | laneMemory[low]) != opcode) group[lane] = 0;
+            }
+        }
+        pending &= ~group;
+
+        Chip8::Instruction instruction;
+        Chip8::decodeInstruction(opcode, instruction);
+
+        uint32_t groupBits = laneBits(group);
+        if(runVector(block, group, instruction)) vectorCount += __builtin_popcount(groupBits);
+        else runScalar(block, base, groupBits, instruction);
+    }
+}
+
+
+/*
+    runVector - runs instruction on the lanes in mask with the Block's vectors, following the
+    matching Chip8 handler exactly, down to the order VF and Vx are written in
+    Return Value : false if the instruction needs memory, the display or the stack
+*/
+bool LockstepEngine::runVector(Block & block, const ByteMask & mask, const Chip8::Instruction & instruction) {
+    WordMask wide = __builtin_convertvector(mask, WordMask);
+    ByteLanes & Vx = block.V[instruction.x];
+    ByteLanes & VF = block.V[0xF];
+    ByteLanes vx = block.V[instruction.x];
+    ByteLanes vy = block.V[instruction.y];
+    ByteLanes kk = (ByteLanes){} + instruction.kk;
+
+    WordLanes next = block.PC + 2;                      //PC after the fetch
+    ByteMask skip = {};
+
+    switch(instruction.index) {
+        case Chip8::OP_0nnn:
+        case Chip8::OP_1nnn: next = (WordLanes){} + instruction.nnn; break;
+        case Chip8::OP_Bnnn: next = instruction.nnn + __builtin_convertvector(block.V[0], WordLanes); break;
+
+        case Chip8::OP_3xkk: skip = vx == kk; break;
+        case Chip8::OP_4xkk: skip = vx != kk; break;
+        case Chip8::OP_5xy0: skip = vx == vy; break;
+        case Chip8::OP_9xy0: skip = vx != vy; break;
+
+        case Chip8::OP_6xkk: blend(Vx, mask, kk); break;
+        case Chip8::OP_7xkk: blend(Vx, mask, vx + kk); break;
+        case Chip8::OP_8xy0: blend(Vx, mask, vy); break;
+        case Chip8::OP_8xy1: blend(Vx, mask, vx | vy); break;
+        case Chip8::OP_8xy2: blend(Vx, mask, vx & vy); break;
+        case Chip8::OP_8xy3: blend(Vx, mask, vx ^ vy); break;
+
+        case Chip8::OP_8xy4: {
+            ByteLanes sum = vx + vy;
+            ByteLanes carry = (ByteLanes)(sum < vx) & 1;
+            blend(Vx, mask, sum);
+            blend(VF, mask, carry);
+            break;
+        }
+        case Chip8::OP_8xy5:
+            blend(VF, mask, (ByteLanes)(vx > vy) & 1);
+            blend(Vx, mask, vx - vy);
+            break;
+        case Chip8::OP_8xy6:
+            blend(VF, mask, vx & 1);
+            blend(Vx, mask, vx >> 1);
+            break;
+        case Chip8::OP_8xy7:
+            blend(VF, mask, (ByteLanes)(vy > vx) & 1);
+            blend(Vx, mask, vy - vx);
+            break;
+        case Chip8::OP_8xyE:
+            blend(VF, mask, vx >> 7);
+            blend(Vx, mask, vx << 1);
+            break;
+
+        case Chip8::OP_Annn: blend(block.I, wide, (WordLanes){} + instruction.nnn); break;
+        case Chip8::OP_Fx1E: blend(block.I, wide, block.I + __builtin_convertvector(vx, WordLanes)); break;
+        case Chip8::OP_Fx29: blend(block.I, wide, FONT_STARTING_ADDRESS + __builtin_convertvector(vx, WordLanes) * 5); break;
+
+        //only the low nibble of Vx names a key, like the handlers
+        case Chip8::OP_Ex9E:
+        case Chip8::OP_ExA1: {
+            WordMask held = (WordMask)((block.keys >> __builtin_convertvector(vx & 0xF, WordLanes)) & 1) != 0;
+            skip = __builtin_convertvector(instruction.index == Chip8::OP_Ex9E ? held : ~held, ByteMask);
+            break;
+        }
+        case Chip8::OP_Fx0A:
+            //the highest key held wins, like the handler's loop. Lanes with none stay put
+            for(uint32_t waiting = laneBits(mask); waiting != 0; waiting &= waiting - 1) {
+                unsigned int lane = __builtin_ctz(waiting);
+                if(block.keys[lane] != 0) block.V[instruction.x][lane] = 31 - __builtin_clz(block.keys[lane]);
+                else next[lane] -= 2;
+            }
+            break;
+
+        case Chip8::OP_Fx07: blend(Vx, mask, block.delayTimer); break;
+        case Chip8::OP_Fx15: blend(block.delayTimer, mask, vx); break;
+        case Chip8::OP_Fx18: blend(block.soundTimer, mask, vx); break;
+
+        default:
+            return false;
+    }
+
+    next += (WordLanes)__builtin_convertvector(skip, WordMask) & 2;
+    blend(block.PC, wide, next);
+    return true;
+}
+
+
+/*
+    runScalar - runs the instruction on each lane's own Chip8 through the regular handler
+*/
+void LockstepEngine::runScalar(Block & block, size_t base, uint32_t lanesToRun, const Chip8::Instruction & instruction) {
+    scalarCount += __builtin_popcount(lanesToRun);
+
+    for(; lanesToRun != 0; lanesToRun &= lanesToRun - 1) {
+        unsigned int lane = __builtin_ctz(lanesToRun);
+        Chip8 & chip8 = *machines[base + lane];
+
+        //memory writes can make the lanes' code differ from here on
+        unsigned int bytesWritten = 0;
+        if(instruction.index == Chip8::OP_Fx33) bytesWritten = 3;
+        if(instruction.index == Chip8::OP_Fx55) bytesWritten = instruction.x + 1;
+        for(unsigned int i = 0; i < bytesWritten; i++)
+            block.written[(block.I[lane] + i) & (MEMORY_BUFF_SIZE - 1)] = true;
+
+        storeLane(block, lane, chip8);
+        chip8.cycle();
+        loadLane(block, lane, chip8);
+    }
+}
+
+
+
+
+void LockstepEngine::loadLane(Block & block, unsigned int lane, const Chip8 & chip8) {
+    for(int x = 0; x < 16; x++)
+        block.V[x][lane] = chip8.registers[x];
+    block.PC[lane] = chip8.PC;
+    block.I[lane] = chip8.I;
+    block.delayTimer[lane] = chip8.delay_timer;
+    block.soundTimer[lane] = chip8.sound_timer;
+}
+
+void LockstepEngine::storeLane(const Block & block, unsigned int lane, Chip8 & chip8) const {
+    for(int x = 0; x < 16; x++)
+        chip8.registers[x] = block.V[x][lane];
+    chip8.PC = block.PC[lane];
+    chip8.I = block.I[lane];
+    chip8.delay_timer = block.delayTimer[lane];
+    chip8.sound_timer = block.soundTimer[lane];
+}
+
+
+/*
+    reset - refills every Block from the lanes' machines, the lanes' memory is the image again
+*/
+void LockstepEngine::reset() {
+    if(lanes != 0) std::memcpy(image, machines[0]->MEMORY_BUFF, MEMORY_BUFF_SIZE);
+
+    for(size_t b = 0; b < blocks.size(); b++) {
+        Block & block = blocks[b];
+        WordLanes keys = block.keys;                    //held keys outlive a ROM load
+        block = Block();
+        block.keys = keys;
+
+        for(unsigned int lane = 0; lane < BLOCK_LANES && b * BLOCK_LANES + lane < lanes; lane++) {
+            block.live[lane] = 0xFF;
+            loadLane(block, lane, *machines[b * BLOCK_LANES + lane]);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef SDLTEST_LOCKSTEP_ENGINE_H
+#define SDLTEST_LOCKSTEP_ENGINE_H
+
+#include <memory>
+#include <vector>
+#include "Chip8.h"
+
+
+/*
+LockstepEngine - steps many copies of one ROM at once, for workloads that run thousands of
+    machines side by side with different input.
+
+    Lanes are grouped into Blocks, and a Block keeps the registers, PC, I and timers of its lanes
+    in structure-of-arrays form, one vector per register. Every step the lanes of a Block that
+    share a PC (and the opcode there) run that instruction together: register, jump, skip, I,
+    timer and keypad instructions through vector kernels, everything else through Chip8::cycle()
+    one lane at a time. Lanes that have diverged are grouped by PC and run the same way, so a lane
+    always sees exactly the instructions its own Chip8 would.
+
+    Memory, the display and the stack stay in a Chip8 per lane, the same one the scalar steps run
+    on. Keys are set through the engine, which keeps them in the Block and the lane's keypad.
+
+    The kernels use GCC/Clang vector extensions. A Block holds as many lanes as one hardware
+    vector has uint16_t slots, 16 when built for AVX2 (CHIP8_AVX2 in CMake) and 8 with SSE2, wider
+    vectors are split into scalar code by GCC. One engine runs on one thread, give each core its
+    own engine to use them all.
+*/
+class LockstepEngine {
+public:
+#if defined(__AVX2__)
+    static const unsigned int BLOCK_LANES = 16;
+#else
+    static const unsigned int BLOCK_LANES = 8;
+#endif
+
+    explicit LockstepEngine(size_t lanes);
+
+    //the same ROM goes into every lane, every lane's PC goes back to STARTING_ADDR
+    bool loadROM(const std::string & filename);
+    bool loadROM(const uint8_t * data, size_t size);
+    void setInstructionsPerFrame(int instructionsPerFrame);
+
+    //every lane runs one frame worth of instructions then ticks its timers
+    void frame();
+
+    size_t laneCount() const { return lanes; }
+
+    //keys the lane holds from now on, bit k for key k
+    void setKeys(size_t lane, uint16_t keys);
+    void seedRandom(size_t lane, uint64_t seed) { machines[lane]->seedRandom(seed); }
+    const uint64_t * display(size_t lane) const { return machines[lane]->DisplayBuffer; }
+
+    //the lane's machine brought up to date with its registers, for reading only
+    const Chip8 & machine(size_t lane);
+
+    //lane instructions run by the vector kernels and one lane at a time
+    uint64_t vectorInstructions() const { return vectorCount; }
+    uint64_t scalarInstructions() const { return scalarCount; }
+
+private:
+    typedef uint8_t ByteLanes __attribute__((vector_size(BLOCK_LANES)));
+    typedef int8_t ByteMask __attribute__((vector_size(BLOCK_LANES)));
+    typedef uint16_t WordLanes __attribute__((vector_size(2 * BLOCK_LANES)));
+    typedef int16_t WordMask __attribute__((vector_size(2 * BLOCK_LANES)));
+
+    struct Block {
+        ByteLanes V[16];
+        WordLanes PC;
+        WordLanes I;
+        ByteLanes delayTimer;
+        ByteLanes soundTimer;
+        WordLanes keys;                                 //bit k set while key k is held
+        ByteLanes live;                                 //0xFF for lanes that exist
+
+        //bytes some lane has written since the ROM was loaded, an opcode fetched from one
+        //of them may differ between lanes with the same PC
+        std::bitset<MEMORY_BUFF_SIZE> written;
+    };
+
+    void stepBlock(Block & block, size_t base);
+    bool runVector(Block & block, const ByteMask & mask, const Chip8::Instruction & instruction);
+    void runScalar(Block & block, size_t base, uint32_t lanesToRun, const Chip8::Instruction & instruction);
+
+    void loadLane(Block & block, unsigned int lane, const Chip8 & chip8);
+    void storeLane(const Block & block, unsigned int lane, Chip8 & chip8) const;
+    void reset();
+
+
+    size_t lanes;
+    int instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    std::vector<std::unique_ptr<Chip8>> machines;
+    std::vector<Block> blocks;
+    uint8_t image[MEMORY_BUFF_SIZE] = {0};              //memory every lane starts from, opcodes
+                                                        //come from here unless a lane wrote them
+
+    uint64_t vectorCount = 0;
+    uint64_t scalarCount = 0;
+};
+
+#endif //SDLTEST_LOCKSTEP_ENGINE_H
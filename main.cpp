@@ -1,19 +1,110 @@
 #include "Chip8.h"
+#include "console_interface.h"
+#include "movie.h"
+#include "rewind_buffer.h"
 #include <SDL2/SDL.h>
+#include <memory>
 
+
+/*
+    Usage: Chip8 [rom] [--turbo] [--run-ahead N] [--seed N] [--record movie] [--play movie [--headless]]
+                 [--profile profile.json] [--trace trace.bin]
+
+    The ROM is looked up in ROMS/, without one it is asked for. --record writes the keys of
+    every frame to a movie when the window closes, --play feeds them back instead of the
+    keyboard. Both turn --turbo off, movies hold one set of keys per frame. --headless plays the
+    movie without a window, rewind history or pacing, as fast as the host allows, then prints
+    how long it took - a run that is the same on every build, for benchmarking.
+    --profile writes where the run spent its instructions once it ends, CHIP8_PROFILE builds only.
+    --trace keeps the last instructions run and writes them on the first bad opcode and at exit,
+    chip8trace prints them.
+*/
 int main(int argc, char *argv[]) {
-    Chip8 console("Chip8", 15, 1);
-    std::string ROM_Name;
+    std::string ROM_Name, recordFile, playFile, profileFile, traceFile;
+    bool turbo = false, headless = false;
+    int runAhead = 0;
+    uint64_t seed = Chip8::DEFAULT_RANDOM_SEED;
+
+    for(int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(option == "--turbo") turbo = true;
+        else if(option == "--headless") headless = true;
+        else if(option == "--run-ahead" && hasValue) runAhead = std::atoi(argv[++i]);
+        else if(option == "--seed" && hasValue) seed = std::strtoull(argv[++i], nullptr, 0);
+        else if(option == "--record" && hasValue) recordFile = argv[++i];
+        else if(option == "--play" && hasValue) playFile = argv[++i];
+        else if(option == "--profile" && hasValue) profileFile = argv[++i];
+        else if(option == "--trace" && hasValue) traceFile = argv[++i];
+        else ROM_Name = option;
+    }
+
+    Movie movie;
+    if(!playFile.empty()) {
+        if(!movie.load(playFile)) return 1;
+        seed = movie.seed;
+    }
+    else if(headless) {
+        std::cout << "Error: --headless needs a movie to --play\n";
+        return 1;
+    }
+    if((!recordFile.empty() || !playFile.empty()) && turbo) {
+        std::cout << "Turbo polls input once per present, not once per frame, so movies "
+                  << (recordFile.empty() ? "play" : "record") << " without it\n";
+        turbo = false;
+    }
+
+    std::unique_ptr<ConsoleInterface> frontend;
+    if(!headless) frontend.reset(new ConsoleInterface("Chip-8", WIDTH, HEIGHT, 15));
+    RealTimeClock clock(FRAME_RATE);
+    Chip8 console(frontend.get(), frontend.get(), frontend.get(), headless ? nullptr : &clock);
+    RewindBuffer rewind;                        //hold Backspace to step back in time
+    if(!headless) console.setRewindBuffer(&rewind);     //nobody to hold it, and it would be timed
+    console.setTurbo(turbo);
+    console.setRunAhead(runAhead);
+    console.seedRandom(seed);
+    TraceBuffer trace;
+    if(!traceFile.empty()) {
+        trace.setTrapFile(traceFile);
+        console.setTrace(&trace);
+    }
 
 
 
-    bool romLoaded = false;
+    bool romLoaded = !ROM_Name.empty() && console.loadROM("ROMS/" + ROM_Name);
     while(!romLoaded) {
         std::cout << "Enter ROM name in folders /ROMS\n\n";
         std::cin >> ROM_Name;
         romLoaded = console.loadROM("ROMS/" + ROM_Name);
     }
 
-    console.run();
+    MovieRecorder recorder(frontend.get(), movie);
+    MoviePlayer player(movie, frontend.get());
+    if(!playFile.empty()) {
+        if(movie.romHash != console.romHash()) {
+            std::cout << "Error: " << playFile << " was recorded on a different ROM\n";
+            return 1;
+        }
+        console.setInstructionsPerFrame(movie.instructionsPerFrame);
+        console.input = &player;
+    }
+    else if(!recordFile.empty()) {
+        movie.romHash = console.romHash();
+        movie.seed = seed;
+        console.input = &recorder;
+    }
+
+    //SDL keeps the window on this thread, emulation gets one of its own
+    auto start = std::chrono::steady_clock::now();
+    if(frontend) frontend->runEmulation([&] { console.run(); });
+    else console.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if(headless)
+        std::cout << player.framesPlayed() << " frames, " << console.instructionsExecuted() << " instructions in "
+                  << elapsed.count() << " s, " << console.instructionsExecuted() / elapsed.count() / 1e6 << " MIPS\n";
+    if(!recordFile.empty() && !movie.save(recordFile)) return 1;
+    if(!profileFile.empty() && !console.writeProfile(profileFile)) return 1;
+    if(!traceFile.empty() && !console.dumpTrace(traceFile)) return 1;
     return 0;
-}
\ No newline at end of file
+}
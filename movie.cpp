@@ -0,0 +1,96 @@
+#include "movie.h"
+
+
+template<typename T> static void put(std::ofstream & out, T value) {
+    for(size_t i = 0; i < sizeof(T); i++)
+        out.put((char)((uint64_t)value >> (8 * i)));
+}
+
+template<typename T> static bool get(std::ifstream & in, T & value) {
+    uint64_t bytes = 0;
+    for(size_t i = 0; i < sizeof(T); i++) {
+        int byte = in.get();
+        if(byte == EOF) return false;
+        bytes |= (uint64_t)byte << (8 * i);
+    }
+    value = (T)bytes;
+    return true;
+}
+
+
+/*
+    save - writes the movie
+    Return Value : false if the file cannot be written
+*/
+bool Movie::save(const std::string & filename) const {
+    std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+    if(!out.is_open()) {
+        std::cout << "Error: cannot write movie " << filename << "\n";
+        return false;
+    }
+
+    put(out, MAGIC);
+    put(out, VERSION);
+    put(out, (uint16_t)0);
+    put(out, romHash);
+    put(out, seed);
+    put(out, instructionsPerFrame);
+    put(out, (uint32_t)frames.size());
+    for(uint16_t keys : frames)
+        put(out, keys);
+
+    return out.good();
+}
+
+
+/*
+    load - reads a movie written by save
+    Return Value : false if the file is missing, from another version or cut short
+*/
+bool Movie::load(const std::string & filename) {
+    std::ifstream in(filename, std::ifstream::in | std::ifstream::binary);
+    if(!in.is_open()) {
+        std::cout << "Error: movie " << filename << " does not exist!\n";
+        return false;
+    }
+
+    uint32_t magic = 0, count = 0;
+    uint16_t version = 0, reserved = 0;
+    if(!get(in, magic) || !get(in, version) || magic != MAGIC || version != VERSION) {
+        std::cout << "Error: " << filename << " is not a version " << VERSION << " Chip8 movie\n";
+        return false;
+    }
+
+    bool ok = get(in, reserved) && get(in, romHash) && get(in, seed) && get(in, instructionsPerFrame) && get(in, count);
+    frames.assign(ok ? count : 0, 0);
+    for(size_t i = 0; ok && i < frames.size(); i++)
+        ok = get(in, frames[i]);
+
+    if(!ok) std::cout << "Error: movie " << filename << " is cut short\n";
+    return ok;
+}
+
+
+
+
+bool MovieRecorder::recordInput(bool * keypad) {
+    if(source != nullptr && source->recordInput(keypad)) return true;
+
+    uint16_t keys = 0;
+    for(int key = 0; key < 16; key++)
+        keys |= keypad[key] << key;
+    movie.frames.push_back(keys);
+    return false;
+}
+
+
+bool MoviePlayer::recordInput(bool * keypad) {
+    bool ignored[16] = {false};
+    if(source != nullptr && source->recordInput(ignored)) return true;
+    if(next == movie.frames.size()) return true;
+
+    uint16_t keys = movie.frames[next++];
+    for(int key = 0; key < 16; key++)
+        keypad[key] = (keys >> key) & 1;
+    return false;
+}
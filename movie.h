@@ -0,0 +1,65 @@
+#ifndef SDLTEST_MOVIE_H
+#define SDLTEST_MOVIE_H
+
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+
+/*
+Movie - the keys held on every frame of a run, plus what else it takes to repeat the run exactly:
+    the ROM it was made on, the seed of Cxkk's generator and the instructions per frame.
+
+    File layout, little endian:
+        "C8MV" magic, uint16_t version, uint16_t reserved
+        uint64_t ROM hash, uint64_t random seed, uint32_t instructions per frame
+        uint32_t frame count, then one uint16_t per frame with bit k set while key k is held
+*/
+struct Movie {
+    static const uint32_t MAGIC = 0x564D3843;
+    static const uint16_t VERSION = 1;
+
+    uint64_t romHash = 0;
+    uint64_t seed = Chip8::DEFAULT_RANDOM_SEED;
+    uint32_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    std::vector<uint16_t> frames;
+
+    bool save(const std::string & filename) const;
+    bool load(const std::string & filename);
+};
+
+
+/*
+MovieRecorder - Input that passes another Input's keys through and appends them to a movie, one
+    frame per recordInput call. Chip8::run polls once per frame unless in turbo mode, so record
+    without turbo. Rewinding is never passed on, a movie only moves forward
+*/
+class MovieRecorder : public Input {
+public:
+    MovieRecorder(Input * source, Movie & movie) : source(source), movie(movie) {}
+    bool recordInput(bool * keypad) override;
+
+private:
+    Input * source;
+    Movie & movie;
+};
+
+
+/*
+MoviePlayer - Input that plays a movie's keys back and asks to quit once it runs out. The source,
+    if there is one, is still polled so a window keeps responding and can end playback early
+*/
+class MoviePlayer : public Input {
+public:
+    explicit MoviePlayer(const Movie & movie, Input * source = nullptr) : movie(movie), source(source) {}
+    bool recordInput(bool * keypad) override;
+
+    size_t framesPlayed() const { return next; }
+
+private:
+    const Movie & movie;
+    Input * source;
+    size_t next = 0;
+};
+
+#endif //SDLTEST_MOVIE_H
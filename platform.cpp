@@ -0,0 +1,19 @@
+#include "platform.h"
+#include <thread>
+
+
+RealTimeClock::RealTimeClock(int framesPerSecond) {
+    framePeriod = std::chrono::nanoseconds(1000000000 / (framesPerSecond > 0 ? framesPerSecond : 1));
+    nextFrame = std::chrono::steady_clock::now();
+}
+
+/*
+    waitForFrame - sleeps off whatever is left of the current frame
+*/
+void RealTimeClock::waitForFrame() {
+    nextFrame += framePeriod;
+
+    auto now = std::chrono::steady_clock::now();
+    if(nextFrame < now) nextFrame = now;
+    else std::this_thread::sleep_until(nextFrame);
+}
@@ -0,0 +1,76 @@
+#ifndef SDLTEST_PLATFORM_H
+#define SDLTEST_PLATFORM_H
+
+#include <cstdint>
+#include <chrono>
+
+
+/*
+Platform interfaces - everything Chip8::run needs from the outside world. The core never talks
+to a window, keyboard or sound device itself, a frontend implements these (ConsoleInterface
+does all three with SDL) and a headless caller can leave any of them out.
+*/
+
+/*
+Display - receives the framebuffer once per present. One uint64_t per row with the leftmost
+    pixel in the top bit, dirtyRows has bit y set for every row changed since the last call
+*/
+class Display {
+public:
+    static const uint32_t ALL_ROWS = 0xFFFFFFFF;
+
+    virtual ~Display() {}
+    virtual void renderDisplay(const uint64_t * buff, uint32_t dirtyRows) = 0;
+
+    //run() is about to start presenting / has stopped presenting
+    virtual void start() {}
+    virtual void stop() {}
+};
+
+/*
+Input - updates the 16 keypad flags
+    Return Value : true when the user asked to quit
+*/
+class Input {
+public:
+    virtual ~Input() {}
+    virtual bool recordInput(bool * keypad) = 0;
+
+    //true while the user holds the rewind control, asked after every recordInput
+    virtual bool rewinding() { return false; }
+};
+
+/*
+Audio - the tone plays for as long as the sound timer is non zero
+*/
+class Audio {
+public:
+    virtual ~Audio() {}
+    virtual void setTone(bool on) = 0;
+};
+
+/*
+Timing - paces run() at one frame per call to waitForFrame
+*/
+class Timing {
+public:
+    virtual ~Timing() {}
+    virtual void waitForFrame() = 0;
+};
+
+
+/*
+RealTimeClock - Timing at a fixed rate against the host's steady clock. A host that fell behind
+    starts counting again from now instead of rushing to catch up
+*/
+class RealTimeClock : public Timing {
+public:
+    explicit RealTimeClock(int framesPerSecond);
+    void waitForFrame() override;
+
+private:
+    std::chrono::nanoseconds framePeriod;
+    std::chrono::steady_clock::time_point nextFrame;
+};
+
+#endif //SDLTEST_PLATFORM_H
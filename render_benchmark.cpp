@@ -0,0 +1,59 @@
+#include "Chip8.h"
+#include "console_interface.h"
+
+
+/*
+render_benchmark - times ConsoleInterface::renderDisplay through both render paths on SDL's
+    software renderer, so the numbers don't depend on the GPU or its driver.
+
+    Every frame draws a different half lit screen so neither path can get away with drawing the
+    same thing twice. Run with SDL_VIDEODRIVER=dummy to measure without a visible window.
+
+    Usage: render_benchmark [frames] [scale]
+*/
+static double timeFrames(ConsoleInterface & console, int frames) {
+    uint64_t buff[HEIGHT];
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < frames; frame++) {
+        for(int y = 0; y < HEIGHT; y++) {
+            //xorshift64, about half the pixels are lit
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            buff[y] = state;
+        }
+        console.renderDisplay(buff);
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / frames;
+}
+
+
+int main(int argc, char *argv[]) {
+    int frames = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int scale = argc > 2 ? std::atoi(argv[2]) : 15;
+    if(frames <= 0 || scale <= 0) {
+        std::cout << "Usage: render_benchmark [frames] [scale]\n";
+        return 1;
+    }
+
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+    ConsoleInterface console("render benchmark", WIDTH, HEIGHT, scale);
+
+    const ConsoleInterface::RenderPath paths[2] = {ConsoleInterface::RENDER_POINTS, ConsoleInterface::RENDER_TEXTURE};
+    const char * names[2] = {"SDL_RenderDrawPoint", "streaming texture"};
+
+    for(int i = 0; i < 2; i++) {
+        console.setRenderPath(paths[i]);
+        timeFrames(console, frames / 10 + 1);          //warm up caches and the texture
+
+        double microseconds = timeFrames(console, frames);
+        std::cout << names[i] << ": " << microseconds << " us/frame, "
+                  << 1e6 / microseconds << " frames/s\n";
+    }
+
+    return 0;
+}
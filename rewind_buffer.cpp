@@ -0,0 +1,166 @@
+#include "rewind_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+
+RewindBuffer::RewindBuffer(size_t capacity)
+        : ring(capacity), scratch(3 * sizeof(Chip8::SaveState)) {
+}
+
+
+void RewindBuffer::record(const Chip8::SaveState & state) {
+    if(!haveNewest) {
+        newest = state;
+        haveNewest = true;
+        return;
+    }
+
+    //the XOR of the two states, zero wherever they agree - a word at a time, SaveState's
+    //size is a multiple of its 8 byte alignment
+    const uint8_t * now = reinterpret_cast<const uint8_t *>(&state);
+    const uint8_t * before = reinterpret_cast<const uint8_t *>(&newest);
+    uint8_t * delta = scratch.data();
+    for(size_t i = 0; i < sizeof(Chip8::SaveState); i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, now + i, 8);
+        std::memcpy(&b, before + i, 8);
+        a ^= b;
+        std::memcpy(delta + i, &a, 8);
+    }
+
+    uint8_t * encoded = delta + sizeof(Chip8::SaveState);
+    size_t length = encode(delta, sizeof(Chip8::SaveState), encoded);
+    newest = state;
+
+    //a ring too small for even one entry can only hold the newest state
+    if(length + ENTRY_FRAMING > ring.size()) {
+        head = tail = used = entries = 0;
+        return;
+    }
+    while(ring.size() - used < length + ENTRY_FRAMING) dropOldest();
+
+    uint8_t framing[2] = {(uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+    write(framing, 2);
+    write(encoded, length);
+    write(framing, 2);
+    entries++;
+}
+
+
+bool RewindBuffer::rewind(Chip8::SaveState & state) {
+    if(entries == 0) return false;
+
+    size_t length = readLength((tail + ring.size() - 2) % ring.size());
+    size_t start = (tail + ring.size() - 2 - length) % ring.size();
+    read(start, scratch.data(), length);
+    decodeInto(scratch.data(), length, reinterpret_cast<uint8_t *>(&newest));
+
+    tail = (tail + ring.size() - length - ENTRY_FRAMING) % ring.size();
+    used -= length + ENTRY_FRAMING;
+    entries--;
+
+    state = newest;
+    return true;
+}
+
+
+void RewindBuffer::clear() {
+    head = tail = used = entries = 0;
+    haveNewest = false;
+}
+
+
+
+
+/*
+    encode - run-length encodes a delta as (zeros to skip, bytes that follow, the bytes) runs,
+    both counts as 7-bit varints. A literal run only ends at two zeros in a row, a lone zero is
+    cheaper to copy than to start a new run for. Trailing zeros are left out.
+    Return Value : encoded length, never more than size + 4
+*/
+size_t RewindBuffer::encode(const uint8_t * delta, size_t size, uint8_t * out) {
+    auto varint = [&out](size_t value) {
+        while(value >= 0x80) {
+            *out++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = (uint8_t)value;
+    };
+
+    const uint8_t * begin = out;
+    size_t position = 0;
+    while(true) {
+        size_t zeros = position;
+        uint64_t word;
+        while(position + 8 <= size && (std::memcpy(&word, delta + position, 8), word == 0)) position += 8;
+        while(position < size && delta[position] == 0) position++;
+        if(position == size) break;
+        zeros = position - zeros;
+
+        size_t literal = position;
+        while(position < size && (delta[position] != 0 || (position + 1 < size && delta[position + 1] != 0)))
+            position++;
+
+        varint(zeros);
+        varint(position - literal);
+        std::memcpy(out, delta + literal, position - literal);
+        out += position - literal;
+    }
+    return out - begin;
+}
+
+/*
+    decodeInto - XORs an encoded delta back into target, which turns the later state into the
+    earlier one
+*/
+void RewindBuffer::decodeInto(const uint8_t * in, size_t length, uint8_t * target) {
+    auto varint = [&in]() {
+        size_t value = 0;
+        for(int shift = 0; ; shift += 7) {
+            uint8_t byte = *in++;
+            value |= (size_t)(byte & 0x7F) << shift;
+            if(byte < 0x80) return value;
+        }
+    };
+
+    const uint8_t * end = in + length;
+    size_t position = 0;
+    while(in < end) {
+        position += varint();
+        size_t literal = varint();
+        for(size_t i = 0; i < literal; i++)
+            target[position + i] ^= in[i];
+        in += literal;
+        position += literal;
+    }
+}
+
+
+
+
+void RewindBuffer::write(const uint8_t * data, size_t size) {
+    size_t first = std::min(size, ring.size() - tail);
+    std::memcpy(ring.data() + tail, data, first);
+    std::memcpy(ring.data(), data + first, size - first);
+    tail = (tail + size) % ring.size();
+    used += size;
+}
+
+void RewindBuffer::read(size_t position, uint8_t * data, size_t size) const {
+    size_t first = std::min(size, ring.size() - position);
+    std::memcpy(data, ring.data() + position, first);
+    std::memcpy(data + first, ring.data(), size - first);
+}
+
+size_t RewindBuffer::readLength(size_t position) const {
+    uint8_t framing[2];
+    read(position, framing, 2);
+    return framing[0] | (framing[1] << 8);
+}
+
+void RewindBuffer::dropOldest() {
+    size_t length = readLength(head);
+    head = (head + length + ENTRY_FRAMING) % ring.size();
+    used -= length + ENTRY_FRAMING;
+    entries--;
+}
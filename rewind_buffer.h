@@ -0,0 +1,61 @@
+#ifndef SDLTEST_REWIND_BUFFER_H
+#define SDLTEST_REWIND_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+#include "Chip8.h"
+
+
+/*
+RewindBuffer - a fixed amount of history to step a machine backwards through, one recorded
+    state at a time.
+
+    Only the newest state is kept whole. Every older one is stored as the XOR of it and the
+    state after it, run-length encoded: the XOR is zero wherever the two states agree, which is
+    nearly all of memory, so a frame usually costs a few dozen bytes. Entries live back to back
+    in one ring of bytes, framed by their length at both ends so the ring can be walked from
+    either side; when a new entry does not fit, the oldest ones are dropped to make room.
+    Nothing is allocated after construction.
+*/
+class RewindBuffer {
+public:
+    static const size_t DEFAULT_CAPACITY = 512 * 1024;     //bytes, minutes of typical games
+
+    explicit RewindBuffer(size_t capacity = DEFAULT_CAPACITY);
+
+    //adds state as the newest point in history
+    void record(const Chip8::SaveState & state);
+
+    /*
+        rewind - drops the newest state and gives back the one recorded before it
+        Return Value : false, with state untouched, once history has run out
+    */
+    bool rewind(Chip8::SaveState & state);
+    void clear();
+
+    size_t frames() const { return entries; }             //how many times rewind() can succeed
+    size_t bytesUsed() const { return used; }
+
+private:
+    static const size_t ENTRY_FRAMING = 4;                  //uint16_t length before and after
+
+    static size_t encode(const uint8_t * delta, size_t size, uint8_t * out);
+    static void decodeInto(const uint8_t * in, size_t length, uint8_t * target);
+
+    void write(const uint8_t * data, size_t size);
+    void read(size_t position, uint8_t * data, size_t size) const;
+    size_t readLength(size_t position) const;
+    void dropOldest();
+
+    std::vector<uint8_t> ring;
+    size_t head = 0;                                        //first byte of the oldest entry
+    size_t tail = 0;                                        //one past the newest entry
+    size_t used = 0;
+    size_t entries = 0;
+
+    Chip8::SaveState newest;
+    bool haveNewest = false;
+    std::vector<uint8_t> scratch;                           //XOR of two states, then its encoding
+};
+
+#endif //SDLTEST_REWIND_BUFFER_H
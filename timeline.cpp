@@ -0,0 +1,151 @@
+#include "timeline.h"
+#include <algorithm>
+#include <iterator>
+
+
+Timeline::Timeline(Chip8 & chip8, size_t maxCheckpoints, uint64_t spacing)
+        : chip8(chip8), maxCheckpoints(maxCheckpoints < 2 ? 2 : maxCheckpoints), spacing(spacing ? spacing : 1) {
+    checkpoint();
+}
+
+
+void Timeline::resume() {
+    history.erase(history.upper_bound(now()), history.end());
+
+    size_t keep = keyLog.size();
+    while(keep > 0 && keyLog[keep - 1].instruction > now()) keep--;
+    keyLog.resize(keep);
+    nextKey = keep;
+}
+
+
+void Timeline::record() {
+    if(now() - lastCheckpoint >= spacing) checkpoint();
+}
+
+
+void Timeline::setKeys(uint16_t keys) {
+    resume();
+    keyLog.push_back(KeyChange{now(), keys});
+    applyKeys();
+}
+
+
+bool Timeline::stepBack() {
+    if(now() <= start()) return false;
+
+    uint64_t target = now() - 1;
+    restore(target);
+    replay(target);
+    return true;
+}
+
+
+Chip8::StopReason Timeline::continueBack() {
+    //one stretch between checkpoints at a time, newest first, until one has a hit in it
+    uint64_t before = now(), end = before;
+    while(end > start()) {
+        uint64_t from = std::prev(history.upper_bound(end - 1))->first;
+        restore(from);
+
+        uint64_t hitAt = 0;
+        Chip8::StopReason hit = replay(end, &hitAt, before);
+        if(hit != Chip8::STOP_NONE) {
+            //the replay left checkpoints close by, a watchpoint's write is run again for watchpointHit()
+            restore(hit == Chip8::STOP_WATCHPOINT ? hitAt - 1 : hitAt);
+            replay(hitAt);
+            return hit;
+        }
+        end = from;
+    }
+
+    restore(start());
+    replay(start());
+    return Chip8::STOP_NONE;
+}
+
+
+
+
+/*
+    restore - loads the last checkpoint at or before instruction, replay() takes it from there
+*/
+void Timeline::restore(uint64_t instruction) {
+    auto latest = std::prev(history.upper_bound(instruction));
+    chip8.loadState(latest->second);
+    lastCheckpoint = latest->first;
+
+    //changes logged before the checkpoint are in its keys, one logged at it may have come after
+    nextKey = 0;
+    while(nextKey < keyLog.size() && keyLog[nextKey].instruction < lastCheckpoint) nextKey++;
+}
+
+
+/*
+    replay - steps the machine forward to target, checkpointing on the way
+    Return Value : with lastHit set, the last breakpoint or watchpoint hit at a position before
+    hitsBefore, the position goes in lastHit. A watchpoint written by the instruction reaching
+    target counts when target is before hitsBefore
+*/
+Chip8::StopReason Timeline::replay(uint64_t target, uint64_t * lastHit, uint64_t hitsBefore) {
+    Chip8::StopReason hit = Chip8::STOP_NONE;
+
+    while(now() < target) {
+        applyKeys();
+        if(now() - lastCheckpoint >= spacing) checkpoint();
+
+        if(lastHit != nullptr && chip8.atBreakpoint()) {
+            hit = Chip8::STOP_BREAKPOINT;
+            *lastHit = now();
+        }
+        chip8.step();
+        if(lastHit != nullptr && chip8.stopReason() == Chip8::STOP_WATCHPOINT && now() < hitsBefore) {
+            hit = Chip8::STOP_WATCHPOINT;
+            *lastHit = now();
+        }
+    }
+    applyKeys();
+    return hit;
+}
+
+
+void Timeline::applyKeys() {
+    for(; nextKey < keyLog.size() && keyLog[nextKey].instruction <= now(); nextKey++) {
+        for(int key = 0; key < 16; key++)
+            chip8.keypad[key] = (keyLog[nextKey].keys >> key) & 1;
+    }
+}
+
+
+void Timeline::checkpoint() {
+    chip8.saveState(history[now()]);
+    lastCheckpoint = now();
+
+    if(history.size() > maxCheckpoints) evict();
+}
+
+
+/*
+    evict - drops the checkpoint whose removal leaves the smallest gap relative to its distance
+    from now, never the first one
+*/
+void Timeline::evict() {
+    auto victim = history.end();
+    double best = 0;
+
+    for(auto entry = std::next(history.begin()); entry != history.end(); ++entry) {
+        auto next = std::next(entry);
+        uint64_t before = std::prev(entry)->first;
+        uint64_t after = next != history.end() ? next->first : std::max(entry->first, now());
+        uint64_t distance = entry->first > now() ? entry->first - now() : now() - entry->first;
+
+        double score = (double)(after - before) / (double)(distance + 1);
+        if(victim == history.end() || score < best) {
+            victim = entry;
+            best = score;
+        }
+    }
+
+    history.erase(victim);
+    lastCheckpoint = std::prev(history.upper_bound(now()))->first;
+}
@@ -0,0 +1,83 @@
+#ifndef SDLTEST_TIMELINE_H
+#define SDLTEST_TIMELINE_H
+
+#include <cstddef>
+#include <map>
+#include <vector>
+#include "Chip8.h"
+
+
+/*
+Timeline - the history of a machine under the debugger, to run it backwards one instruction or
+    one breakpoint at a time.
+
+    A machine is deterministic given its keys, so history is kept as checkpoints (save states,
+    keyed by instruction count) plus a log of every change of keys. Going back to instruction n
+    restores the last checkpoint at or before n and steps forward to n, replaying the keys.
+
+    Checkpoints are taken every spacing instructions while running forward and again while
+    replaying, so the stretch just replayed is dense afterwards and the next step back is cheap.
+    Once there are more than maxCheckpoints, the one whose removal leaves the smallest gap for
+    its distance from the current instruction goes: the spacing grows with the distance, a
+    fixed number of checkpoints covers hours of history and the one nearby is never far.
+    The first checkpoint is never dropped, it is where history starts.
+
+    Running forward from a point in the past starts a new history there: resume() forgets the
+    checkpoints and keys after it, as the run may go differently from then on.
+*/
+class Timeline {
+public:
+    static const size_t DEFAULT_CHECKPOINTS = 256;             //~1.1 MB
+    static const uint64_t DEFAULT_SPACING = 4096;               //instructions, a few dozen µs to replay
+
+    //history starts with the machine as it is now
+    explicit Timeline(Chip8 & chip8, size_t maxCheckpoints = DEFAULT_CHECKPOINTS, uint64_t spacing = DEFAULT_SPACING);
+
+    //running forward - resume() before, record() after every frame() or step()
+    void resume();
+    void record();
+    void setKeys(uint16_t keys);                                //bit k set while key k is held, from now on
+
+    /*
+        stepBack - goes back one instruction
+        Return Value : false, with the machine untouched, at the start of history
+    */
+    bool stepBack();
+
+    /*
+        continueBack - goes back to the last time a breakpoint was reached or a watchpoint
+        written before now: to just before the instruction at the breakpoint, or just after the
+        one writing the watchpoint
+        Return Value : what was hit, STOP_NONE if nothing was and the machine is at the start
+        of history
+    */
+    Chip8::StopReason continueBack();
+
+    size_t checkpoints() const { return history.size(); }
+    uint64_t start() const { return history.begin()->first; }
+
+private:
+    uint64_t now() const { return chip8.instructionsExecuted(); }
+
+    void restore(uint64_t instruction);
+    Chip8::StopReason replay(uint64_t target, uint64_t * lastHit = nullptr, uint64_t hitsBefore = 0);
+    void applyKeys();
+    void checkpoint();
+    void evict();
+
+    Chip8 & chip8;
+    size_t maxCheckpoints;
+    uint64_t spacing;
+
+    std::map<uint64_t, Chip8::SaveState> history;              //by instruction count
+    uint64_t lastCheckpoint = 0;                                //newest one at or before now
+
+    struct KeyChange {
+        uint64_t instruction;
+        uint16_t keys;
+    };
+    std::vector<KeyChange> keyLog;                              //oldest first
+    size_t nextKey = 0;                                         //first change replay() has not applied
+};
+
+#endif //SDLTEST_TIMELINE_H
@@ -0,0 +1,133 @@
+#include "trace_buffer.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+
+TraceBuffer::TraceBuffer(size_t entries) {
+    size = 2;                                               //the newest entry and the one it completes
+    while(size < entries) size <<= 1;
+
+    ring.reset(new Slot[size]());
+    mask = size - 1;
+}
+
+
+void TraceBuffer::finish(const uint8_t * registers) {
+    if(next == 0) return;
+
+    complete(ring[(next - 1) & mask], registers);
+    written.store(next, std::memory_order_release);
+}
+
+
+void TraceBuffer::trap(const uint8_t * registers) {
+    if(trapFile.empty() || trapped) return;
+    trapped = true;
+
+    finish(registers);
+    if(dump(trapFile)) std::cout << "Trace of the last instructions written to " << trapFile << std::endl;
+}
+
+
+void TraceBuffer::snapshot(std::vector<Entry> & entries) const {
+    //entry i shares its slot with entry i + size, anything that one started on may be torn
+    uint64_t end = written.load(std::memory_order_acquire);
+    uint64_t reached = started.load(std::memory_order_relaxed);
+    uint64_t begin = reached > size ? std::min(reached - size, end) : 0;
+
+    entries.resize(end - begin);
+    for(uint64_t i = begin; i < end; i++) {
+        const Slot & slot = ring[i & mask];
+        uint64_t fields = slot.fields.load(std::memory_order_relaxed);
+        entries[i - begin] = Entry{slot.cycle.load(std::memory_order_relaxed), (uint16_t)fields, (uint16_t)(fields >> 16),
+                                   (uint16_t)(fields >> 32), (uint8_t)(fields >> 48), (uint8_t)(fields >> 56)};
+    }
+
+    //and those the writer started on while they were copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    reached = started.load(std::memory_order_relaxed);
+    if(reached > begin + size) {
+        uint64_t torn = std::min<uint64_t>(reached - size - begin, entries.size());
+        entries.erase(entries.begin(), entries.begin() + torn);
+    }
+}
+
+
+
+
+template<typename T> static void put(std::ofstream & out, T value) {
+    for(size_t i = 0; i < sizeof(T); i++)
+        out.put((char)((uint64_t)value >> (8 * i)));
+}
+
+template<typename T> static bool get(std::ifstream & in, T & value) {
+    uint64_t bytes = 0;
+    for(size_t i = 0; i < sizeof(T); i++) {
+        int byte = in.get();
+        if(byte == EOF) return false;
+        bytes |= (uint64_t)byte << (8 * i);
+    }
+    value = (T)bytes;
+    return true;
+}
+
+
+/*
+    dump - writes a snapshot of the trace
+    Return Value : false if the file cannot be written
+*/
+bool TraceBuffer::dump(const std::string & filename) const {
+    std::vector<Entry> entries;
+    snapshot(entries);
+
+    std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+    if(!out.is_open()) {
+        std::cout << "Error: cannot write trace " << filename << "\n";
+        return false;
+    }
+
+    put(out, MAGIC);
+    put(out, VERSION);
+    put(out, (uint16_t)0);
+    put(out, (uint32_t)entries.size());
+    for(const Entry & entry : entries) {
+        put(out, entry.cycle);
+        put(out, entry.PC);
+        put(out, entry.opcode);
+        put(out, entry.I);
+        put(out, entry.Vx);
+        put(out, entry.VF);
+    }
+    return out.good();
+}
+
+
+/*
+    load - reads a trace written by dump
+    Return Value : false if the file is missing, from another version or cut short
+*/
+bool TraceBuffer::load(const std::string & filename, std::vector<Entry> & entries) {
+    std::ifstream in(filename, std::ifstream::in | std::ifstream::binary);
+    if(!in.is_open()) {
+        std::cout << "Error: trace " << filename << " does not exist!\n";
+        return false;
+    }
+
+    uint32_t magic = 0, count = 0;
+    uint16_t version = 0, reserved = 0;
+    if(!get(in, magic) || !get(in, version) || magic != MAGIC || version != VERSION) {
+        std::cout << "Error: " << filename << " is not a version " << VERSION << " Chip8 trace\n";
+        return false;
+    }
+
+    bool ok = get(in, reserved) && get(in, count);
+    entries.assign(ok ? count : 0, Entry());
+    for(Entry & entry : entries) {
+        ok = ok && get(in, entry.cycle) && get(in, entry.PC) && get(in, entry.opcode) && get(in, entry.I)
+                && get(in, entry.Vx) && get(in, entry.VF);
+    }
+
+    if(!ok) std::cout << "Error: trace " << filename << " is cut short\n";
+    return ok;
+}
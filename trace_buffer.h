@@ -0,0 +1,104 @@
+#ifndef SDLTEST_TRACE_BUFFER_H
+#define SDLTEST_TRACE_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/*
+TraceBuffer - the last few thousand instructions a machine ran, kept cheap enough to leave on.
+
+    Chip8 writes one fixed size Entry per instruction into a power of two ring, nothing is
+    allocated or written out while it runs. The registers an instruction changed are only known
+    once it has run, so they are filled in when the next one is recorded and an entry only
+    counts as written from then on.
+
+    One thread records, snapshot() and dump() may run on any other without stopping it. record()
+    works like a seqlock writer: it announces the entry it starts in started before touching a
+    slot and publishes it in written once done. A reader copies up to written, then drops the
+    entries whose slots started says were overwritten while it copied. Slots are relaxed atomic
+    words, a torn copy is thrown away rather than being a data race.
+
+    File layout, little endian: "C8TR" magic, uint16_t version, uint16_t reserved, uint32_t
+    entry count, then the entries oldest first, 16 bytes each in Entry order.
+*/
+class TraceBuffer {
+public:
+    static const size_t DEFAULT_ENTRIES = 4096;
+    static const uint32_t MAGIC = 0x52543843;               //"C8TR"
+    static const uint16_t VERSION = 1;
+
+    struct Entry {
+        uint64_t cycle;                                     //instructions the machine ran before this one
+        uint16_t PC;
+        uint16_t opcode;
+        uint16_t I;                                         //as the instruction found it
+        uint8_t Vx;                                         //V[x] and VF once it had run
+        uint8_t VF;
+    };
+
+    //entries is rounded up to a power of two
+    explicit TraceBuffer(size_t entries = DEFAULT_ENTRIES);
+
+    /*
+        record - the instruction at PC is about to run as the machine's cycle-th, with I as
+        given, registers still hold what the previous instruction left behind
+    */
+    void record(uint64_t cycle, uint16_t PC, uint16_t opcode, uint16_t I, const uint8_t * registers) {
+        uint64_t n = next;
+        uint64_t fields = PC | (uint64_t)opcode << 16 | (uint64_t)I << 32;
+
+        started.store(n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Slot & slot = ring[n & mask];
+        slot.cycle.store(cycle, std::memory_order_relaxed);
+        slot.fields.store(fields, std::memory_order_relaxed);
+        complete(ring[(n - 1) & mask], registers);          //the first time a slot nobody reads yet
+        written.store(n, std::memory_order_release);
+
+        next = n + 1;
+        lastFields = fields;
+    }
+
+    //counts the instruction recorded last as written, to call before dumping the trace
+    void finish(const uint8_t * registers);
+
+    //a bad opcode ran - the first one writes the trace to the trap file, if one is set
+    void trap(const uint8_t * registers);
+    void setTrapFile(const std::string & filename) { trapFile = filename; }
+
+    //the written entries still in the ring, oldest first
+    void snapshot(std::vector<Entry> & entries) const;
+    bool dump(const std::string & filename) const;
+    static bool load(const std::string & filename, std::vector<Entry> & entries);
+
+private:
+    //an entry as stored: cycle, and PC | opcode << 16 | I << 32 | Vx << 48 | VF << 56
+    struct Slot {
+        std::atomic<uint64_t> cycle;
+        std::atomic<uint64_t> fields;
+    };
+
+    //fills in the registers of the entry recorded last, which slot holds
+    void complete(Slot & slot, const uint8_t * registers) {
+        uint64_t Vx = registers[(lastFields >> 24) & 0x0F];
+        uint64_t VF = registers[0x0F];
+        slot.fields.store(lastFields | Vx << 48 | VF << 56, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<Slot[]> ring;
+    uint64_t size;
+    uint64_t mask;
+    uint64_t next = 0;                                      //recording thread only, as is lastFields
+    uint64_t lastFields = 0;
+    std::atomic<uint64_t> started{0};                       //entries below this may be in their slots
+    std::atomic<uint64_t> written{0};                       //entries below this are complete
+    std::string trapFile;
+    bool trapped = false;
+};
+
+#endif //SDLTEST_TRACE_BUFFER_H
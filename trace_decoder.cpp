@@ -0,0 +1,51 @@
+#include "Chip8.h"
+#include <cstring>
+#include <iomanip>
+#include <vector>
+
+
+/*
+chip8trace - prints a trace written by TraceBuffer, one instruction per line, oldest first.
+
+    Usage: chip8trace <trace file>
+
+    Vx and VF are shown after the instruction ran, and only for the instructions that write them.
+*/
+
+static bool writesVx(const char * op) {
+    static const char * const ops[] = {"6xkk", "7xkk", "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5",
+                                       "8xy6", "8xy7", "8xyE", "Cxkk", "Fx07", "Fx0A", "Fx65"};
+    for(const char * writer : ops)
+        if(std::strcmp(op, writer) == 0) return true;
+    return false;
+}
+
+static bool writesVF(const char * op) {
+    return op[0] == 'D' || (op[0] == '8' && std::strchr("4567E", op[3]) != nullptr);
+}
+
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        std::cout << "Usage: chip8trace <trace file>\n";
+        return 1;
+    }
+
+    std::vector<TraceBuffer::Entry> entries;
+    if(!TraceBuffer::load(argv[1], entries)) return 1;
+
+    std::cout << "cycle        PC    opcode  op    I\n" << std::hex << std::setfill('0');
+    for(const TraceBuffer::Entry & entry : entries) {
+        const char * op = Chip8::opcodeName(entry.opcode);
+        std::cout << std::dec << std::setfill(' ') << std::left << std::setw(12) << entry.cycle << std::right
+                  << std::hex << std::setfill('0') << " 0x" << std::setw(3) << entry.PC
+                  << "  " << std::setw(4) << entry.opcode << "    " << std::left << std::setfill(' ') << std::setw(5) << op
+                  << std::right << std::setfill('0') << " 0x" << std::setw(3) << entry.I;
+
+        char x = "0123456789ABCDEF"[(entry.opcode >> 8) & 0x0F];
+        if(writesVx(op)) std::cout << "  V" << x << "=" << std::setw(2) << (int)entry.Vx;
+        if(writesVF(op)) std::cout << "  VF=" << std::setw(2) << (int)entry.VF;
+        std::cout << "\n";
+    }
+    return 0;
+}
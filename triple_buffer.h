@@ -0,0 +1,51 @@
+#ifndef SDLTEST_TRIPLE_BUFFER_H
+#define SDLTEST_TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+
+/*
+TripleBuffer - lock-free handoff of the latest value from one producer thread to one consumer.
+
+    The producer fills writeBuffer() and publish()es it, the consumer calls update() and reads
+    readBuffer(). Each side owns one of the three buffers and the third sits in the middle,
+    publish() and update() swap with the middle one in a single atomic exchange. Neither side
+    ever waits: the producer overwrites a frame the consumer never picked up, and the consumer
+    keeps the frame it has until a newer one is published.
+*/
+template <typename T>
+class TripleBuffer {
+public:
+    T & writeBuffer() { return buffers[back]; }
+    const T & readBuffer() const { return buffers[front]; }
+
+    /*
+        publish - hands the write buffer over as the latest value
+    */
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /*
+        update - takes the latest published value if there is one
+        Return Value : true if readBuffer() changed
+    */
+    bool update() {
+        if(!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4;               //set on the middle index by publish()
+
+    T buffers[3] = {};
+    uint8_t back = 0;                               //producer's
+    uint8_t front = 1;                              //consumer's
+    std::atomic<uint8_t> middle{2};
+};
+
+#endif //SDLTEST_TRIPLE_BUFFER_H
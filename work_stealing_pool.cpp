@@ -0,0 +1,69 @@
+#include "work_stealing_pool.h"
+#include <thread>
+
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    this->threads = threads > 0 ? threads : 1;
+
+    for(unsigned i = 0; i < this->threads; i++)
+        queues.emplace_back(new Queue());
+}
+
+
+void WorkStealingPool::run(size_t jobs, const std::function<void(size_t)> & work) {
+    //deal out contiguous runs, the first jobs % threads workers get one extra
+    size_t next = 0;
+    for(unsigned i = 0; i < threads; i++) {
+        size_t share = jobs / threads + (i < jobs % threads ? 1 : 0);
+        for(size_t j = 0; j < share; j++)
+            queues[i]->jobs.push_back(next++);
+    }
+
+    auto worker = [&](unsigned id) {
+        size_t job;
+        while(pop(id, job) || steal(id, job))
+            work(job);
+    };
+
+    //this thread works too
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < threads; i++)
+        workers.emplace_back(worker, i);
+    worker(0);
+
+    for(auto & thread : workers)
+        thread.join();
+}
+
+
+/*
+    pop - takes the newest job off the worker's own queue
+*/
+bool WorkStealingPool::pop(unsigned worker, size_t & job) {
+    Queue & queue = *queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if(queue.jobs.empty()) return false;
+
+    job = queue.jobs.back();
+    queue.jobs.pop_back();
+    return true;
+}
+
+
+/*
+    steal - takes the oldest job off the first other queue that has one. No job is ever added
+    after run() deals them out, so once a full pass finds nothing the thief is done
+*/
+bool WorkStealingPool::steal(unsigned thief, size_t & job) {
+    for(unsigned i = 1; i < threads; i++) {
+        Queue & victim = *queues[(thief + i) % threads];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(victim.jobs.empty()) continue;
+
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        return true;
+    }
+    return false;
+}
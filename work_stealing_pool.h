@@ -0,0 +1,44 @@
+#ifndef SDLTEST_WORK_STEALING_POOL_H
+#define SDLTEST_WORK_STEALING_POOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/*
+WorkStealingPool - runs a fixed set of independent jobs across every core.
+
+    Jobs are dealt out to the workers in contiguous runs up front. A worker takes jobs from the
+    back of its own queue and, once that is empty, steals from the front of someone else's, so a
+    run of slow jobs landing on one worker gets spread back out over the others.
+*/
+class WorkStealingPool {
+public:
+    //0 threads means one per hardware thread
+    explicit WorkStealingPool(unsigned threads = 0);
+
+    /*
+        run - calls work(job) once for every job in [0, jobs), returns when all have finished
+    */
+    void run(size_t jobs, const std::function<void(size_t)> & work);
+
+    unsigned threadCount() const { return threads; }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    bool pop(unsigned worker, size_t & job);
+    bool steal(unsigned thief, size_t & job);
+
+    unsigned threads;
+    std::vector<std::unique_ptr<Queue>> queues;
+};
+
+#endif //SDLTEST_WORK_STEALING_POOL_H